@@ -1,24 +1,30 @@
-
 #pragma once
 
-#include <wchar.h>
-#include <locale.h>
-#include <stdlib.h>
 #include <limits.h>
-#include <stdio.h>
 #include <stdint.h>
-#include <stddef.h>
 #include <stdbool.h>
 #include <assert.h>
 
-typedef uint64_t bitmap_t;
-typedef uint64_t index_t;
-typedef uint64_t piece_t;
+/* The compact position format: every tile of the board as a 4 bit code,
+   16 tiles to each of four 64 bit words, 32 bytes in all. Besides the
+   pieces the codes carry the rest of what makes a position:
+
+     - whose move it is, as PACKED_BLACK on every empty tile when black
+       is to move
+     - en passant, as the *_PAWN_ENPASSENTABLE code on the pawn that just
+       moved two tiles
+     - castling, as the pawn code of the rook's own color on a corner rook
+       that may still castle. Pawns never stand on the first or last rank,
+       so that code is free there.
+
+   The move counters are not part of it. Positions are compared and hashed
+   a whole word at a time, see board_equal() and board_hash(). */
 
 #define TILE_BITS 4ULL
+#define TILES_PER_WORD (64 / TILE_BITS)
 
-enum piece : piece_t {
-    EMPTY                = 0b0000ULL,
+enum packed_piece {
+    W_EMPTY              = 0b0000ULL,
 
     W_KING               = 0b0001ULL,
     W_QUEEN              = 0b0010ULL,
@@ -37,12 +43,12 @@ enum piece : piece_t {
     B_PAWN               = 0b1110ULL,
     B_PAWN_ENPASSENTABLE = 0b1111ULL,
 
-    BLACK                = 0b1000ULL,
-    #define WHITE 0
+    PACKED_BLACK         = 0b1000ULL,
+    PACKED_PIECE         = 0b0111ULL, /* mask of the piece without its color */
 };
 
-static const char * const piece_str[] = {
-    [EMPTY]                 = "EMPTY",
+static const char * const packed_piece_str[] = {
+    [W_EMPTY]               = "EMPTY",
     [W_KING]                = "W_KING",
     [W_QUEEN]               = "W_QUEEN",
     [W_ROOK]                = "W_ROOK",
@@ -61,89 +67,65 @@ static const char * const piece_str[] = {
     [B_PAWN_ENPASSENTABLE ] = "B_PAWN (enpassentable)",
 };
 
-static const wchar_t piece_symbol[] = {
-    [WHITE | 0]            = ' ',
-    [W_KING]               = 0x265A,
-    [W_QUEEN]              = 0x265B,
-    [W_ROOK]               = 0x265C,
-    [W_BISHOP]             = 0x265D,
-    [W_KNIGHT]             = 0x265E,
-    [W_PAWN]               = 0x265F,
-    [W_PAWN_ENPASSENTABLE] = 0x265F,
-    [B_KING]               = 0x265A,
-    [B_QUEEN]              = 0x265B,
-    [B_ROOK]               = 0x265C,
-    [B_BISHOP]             = 0x265D,
-    [B_KNIGHT]             = 0x265E,
-    [B_PAWN]               = 0x265F,
-    [B_PAWN_ENPASSENTABLE] = 0x265F,
-};
-
 struct board {
-    bitmap_t pieces[4]; // 4 bits correspond to 1 tile
+    uint64_t pieces[4]; // 4 bits correspond to 1 tile
 };
 static_assert(sizeof(((struct board*)0)->pieces) * CHAR_BIT == TILE_BITS*64,
        "pieces must contain enough information to hold a 64 chessboard tiles");
 static_assert((sizeof(((struct board*)0)->pieces[0]) * CHAR_BIT) % TILE_BITS == 0,
-       "bitmap_t in bits must be divisible by TILE_BITS");
+       "a word in bits must be divisible by TILE_BITS");
+static_assert(sizeof(struct board) == 32, "a packed position is 32 bytes");
 
-static inline bitmap_t tile_mask(index_t i)
+static inline uint64_t tile_mask(unsigned i)
 {
     return 0b1111ULL << (TILE_BITS*i);
 }
 
-static inline bool is_white(piece_t piece)
+static inline bool is_white(unsigned piece)
 {
-    return (piece & BLACK) == 0;
+    return (piece & PACKED_BLACK) == 0;
 }
 
-static inline bool is_black(piece_t piece)
+static inline bool is_black(unsigned piece)
 {
-    return (piece & BLACK) == BLACK;
+    return (piece & PACKED_BLACK) == PACKED_BLACK;
 }
 
-static inline piece_t piece_at(struct board* board, index_t tile)
+static inline unsigned piece_at(const struct board* board, unsigned tile)
 {
     static_assert(sizeof board->pieces[0] * CHAR_BIT == 64, "bad refactor");
-    return (tile_mask(tile % (64/TILE_BITS)) & board->pieces[tile / (64/TILE_BITS)]) >> 4ULL*tile;
+    return (board->pieces[tile / TILES_PER_WORD] >> (TILE_BITS * (tile % TILES_PER_WORD))) & 0b1111ULL;
+}
+
+static inline void set_piece_at(struct board* board, unsigned tile, unsigned piece)
+{
+    uint64_t* word = &board->pieces[tile / TILES_PER_WORD];
+    *word = (*word & ~tile_mask(tile % TILES_PER_WORD)) | (uint64_t)piece << (TILE_BITS * (tile % TILES_PER_WORD));
+}
+
+/* The words are combined without branches, so the compiler compares them
+   in one or two vector registers. */
+static inline bool board_equal(const struct board* a, const struct board* b)
+{
+    return ((a->pieces[0] ^ b->pieces[0]) | (a->pieces[1] ^ b->pieces[1])
+          | (a->pieces[2] ^ b->pieces[2]) | (a->pieces[3] ^ b->pieces[3])) == 0;
 }
 
-static void paint_board(struct board* b)
+/* Each word is mixed on its own before they are folded together, so the
+   four lanes vectorize. Not the Zobrist key, but as good for tables of
+   packed positions. */
+static inline uint64_t board_hash(const struct board* b)
 {
-    /* https://en.wikipedia.org/wiki/Chess_symbols_in_Unicode
-       The unicode symbols for the pieces are calculated from adding
-       0x2653 (#define'd as UNICODE_CHESS_SYMBOL) with the piece value. */
-#define BG_RED()       printf("\033[48;2;150;150;0m")
-#define BG_DARKBLUE()  printf("\033[48;2;100;100;150m")
-#define BG_LIGHTBLUE() printf("\033[48;2;150;150;200m")
-#define FG_BLACK()     printf("\033[38;2;0;0;0m")
-#define FG_WHITE()     printf("\033[38;2;255;255;255m")
-    for (int i = 7; i >= 0; i--) {
-        printf("\n %d ", i+1); // number coordinates
-        for (int j = 0; j < 8; j++) {
-            piece_t p = piece_at(b, i*8+j);
-            if ((i + j) % 2) {
-                BG_DARKBLUE();
-            } else {
-                BG_LIGHTBLUE();
-            }
-
-            if (p == EMPTY) {
-                printf("  ");
-                continue;
-            }
-            if (is_white(p)) {
-                FG_WHITE();
-            } else {
-                FG_BLACK();
-            }
-            printf("%lc ", piece_symbol[p]);
-        }
-        printf("\033[0m"); // reset text attributes
+    static const uint64_t k[4] = {
+        0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL,
+        0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL,
+    };
+
+    uint64_t lanes[4];
+    for (int i = 0; i < 4; i++) {
+        const uint64_t x = (b->pieces[i] ^ (b->pieces[i] >> 31)) * k[i];
+        lanes[i] = x ^ (x >> 29);
     }
-    /* horizontal letter coordinates */
-    printf("\n  ");
-    for (int i = 0; i < 8; i++)
-        printf(" %c", 'a' + i);
-    printf("\n");
+    const uint64_t h = (lanes[0] ^ lanes[1]) + (lanes[2] ^ lanes[3]) * k[0];
+    return h ^ (h >> 32);
 }
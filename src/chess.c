@@ -1,11 +1,20 @@
 
+#include <getopt.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "board.h"
 #include "cool_assert.h"
 #include <ctype.h>   /* isalpha, isdigit ... */
+#include <inttypes.h> /* SCNx64 */
 #include <locale.h>  /* setlocale */
-#include <math.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h> /* true, false, bool */
 #include <stddef.h>  /* ptrdiff_t */
 #include <stdint.h>  /* int32_t */
@@ -14,12 +23,21 @@
 #include <string.h>
 
 #define MAX_DEPTH 5
-#define CHECKMATE_SCORE 100000
-#define SET_SIZE 4096
+#define MAX_PLY 64
+#define DEFAULT_HASH_MB 16
+#define MATE_SCORE     32000 /* minus the ply it happens at */
+#define MATE_BOUND     (MATE_SCORE - MAX_PLY)
+#define INFINITE_SCORE 32001
 
 #define RANK       ((index_t)8)
 #define COL        ((index_t)1)
 
+#define FILE_A_BITMAP ((bitmap_t)0x0101010101010101ULL)
+#define FILE_H_BITMAP ((bitmap_t)0x8080808080808080ULL)
+#define RANK_1_BITMAP ((bitmap_t)0x00000000000000FFULL)
+#define RANK_8_BITMAP ((bitmap_t)0xFF00000000000000ULL)
+#define LIGHT_BITMAP  ((bitmap_t)0x55AA55AA55AA55AAULL)
+
 typedef int8_t    piece_t;
 typedef ptrdiff_t index_t;
 typedef uint64_t  bitmap_t;
@@ -76,11 +94,6 @@ enum color {
     WHITE = 1,
 };
 
-static const char * const color_str[] = {
-    "WHITE",
-    "BLACK"
-};
-
 static const char * const color_str_lower[] = {
     "white",
     "black"
@@ -104,83 +117,140 @@ enum chess_piece {
     PIECE_COUNT,
 };
 
-static const double piece_value[] = {
+/* A move packs the tile it moves from and the tile it moves to into 6 bits
+   each, and the piece a pawn promotes to into the 3 bits above them. EMPTY
+   as promotion means a normal move (or a queen promotion for old callers). */
+typedef uint16_t move_t;
+
+#define MOVE_NONE ((move_t)0) /* A1 to A1 is never a legal move */
+#define MAX_MOVES 256         /* no position has more than 218 legal moves */
+
+struct move_list {
+    move_t moves[MAX_MOVES];
+    size_t n;
+};
+
+static inline move_t move_make(index_t from, index_t to, enum chess_piece promotion)
+{
+    return (move_t)(from | (to << 6) | (promotion << 12));
+}
+
+static inline index_t move_from(move_t m)
+{
+    return m & 0x3F;
+}
+
+static inline index_t move_to(move_t m)
+{
+    return (m >> 6) & 0x3F;
+}
+
+static inline enum chess_piece move_promotion(move_t m)
+{
+    return (enum chess_piece)(m >> 12);
+}
+
+static inline void move_list_push(struct move_list* list, index_t from, index_t to, enum chess_piece promotion)
+{
+    assert(list->n < MAX_MOVES);
+    list->moves[list->n++] = move_make(from, to, promotion);
+}
+
+/* writes `m` to `buf` in coordinate notation, like "e2e4" or "e7e8q" */
+static const char* move_str(move_t m, char buf[6])
+{
+    const index_t from = move_from(m);
+    const index_t to   = move_to(m);
+
+    buf[0] = 'a' + from % 8;
+    buf[1] = '1' + from / 8;
+    buf[2] = 'a' + to % 8;
+    buf[3] = '1' + to / 8;
+    buf[4] = " kqrbnp"[move_promotion(m)];
+    buf[move_promotion(m) == EMPTY ? 4 : 5] = '\0';
+    return buf;
+}
+
+/* piece values in centipawns */
+static const int16_t piece_value[] = {
     [EMPTY]  = 0,
-    [PAWN]   = 1,
-    [BISHOP] = 3,
-    [KNIGHT] = 3,
-    [ROOK]   = 5,
-    [QUEEN]  = 9,
-    [KING]   = 10,
+    [PAWN]   = 100,
+    [BISHOP] = 300,
+    [KNIGHT] = 300,
+    [ROOK]   = 500,
+    [QUEEN]  = 900,
+    [KING]   = 1000,
 };
 
-static const double piece_position_bonus[PIECE_COUNT][BOARD_SIZE] = {
+/* centipawns added to a piece's value on each tile, from white's side of the
+   board. Black pieces use the tile mirrored across the middle rank. */
+static const int16_t piece_square_bonus[PIECE_COUNT][BOARD_SIZE] = {
     [EMPTY] = {0},
     [PAWN] = {
-       /*       A    B    C    D    E    F    G    H    */
-       /* 1 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
-       /* 2 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
-       /* 3 */ 1.0, 1.0, 1.4, 1.4, 1.4, 1.4, 1.0, 1.0, 
-       /* 4 */ 1.0, 1.0, 1.4, 1.4, 1.4, 1.4, 1.0, 1.0, 
-       /* 5 */ 1.2, 1.0, 1.4, 1.4, 1.4, 1.4, 1.0, 1.2, 
-       /* 6 */ 1.7, 1.0, 1.4, 1.4, 1.4, 1.4, 1.0, 1.7, 
-       /* 7 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
-       /* 8 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
+       /*       A     B     C     D     E     F     G     H  */
+       /* 1 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 2 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 3 */    0,    0,   40,   40,   40,   40,    0,    0,
+       /* 4 */    0,    0,   40,   40,   40,   40,    0,    0,
+       /* 5 */   20,    0,   40,   40,   40,   40,    0,   20,
+       /* 6 */   70,    0,   40,   40,   40,   40,    0,   70,
+       /* 7 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 8 */    0,    0,    0,    0,    0,    0,    0,    0,
     },
     [BISHOP] = {
-       /*       A    B    C    D    E    F    G    H    */
-       /* 1 */ 1.2, 1.0, 1.0, 1.0, 1.0, 1.0, 1.2, 1.2, 
-       /* 2 */ 1.2, 1.2, 1.0, 1.0, 1.0, 1.2, 1.2, 1.0, 
-       /* 3 */ 1.0, 1.2, 1.2, 1.0, 1.2, 1.2, 1.0, 1.0, 
-       /* 4 */ 1.0, 1.0, 1.2, 1.2, 1.2, 1.0, 1.0, 1.0, 
-       /* 5 */ 1.0, 1.0, 1.2, 1.2, 1.2, 1.0, 1.0, 1.0, 
-       /* 6 */ 1.0, 1.2, 1.2, 1.0, 1.2, 1.2, 1.0, 1.0, 
-       /* 7 */ 1.2, 1.2, 1.0, 1.0, 1.0, 1.2, 1.2, 1.0, 
-       /* 8 */ 1.2, 1.0, 1.0, 1.0, 1.0, 1.0, 1.2, 1.2, 
+       /*       A     B     C     D     E     F     G     H  */
+       /* 1 */   60,    0,    0,    0,    0,    0,   60,   60,
+       /* 2 */   60,   60,    0,    0,    0,   60,   60,    0,
+       /* 3 */    0,   60,   60,    0,   60,   60,    0,    0,
+       /* 4 */    0,    0,   60,   60,   60,    0,    0,    0,
+       /* 5 */    0,    0,   60,   60,   60,    0,    0,    0,
+       /* 6 */    0,   60,   60,    0,   60,   60,    0,    0,
+       /* 7 */   60,   60,    0,    0,    0,   60,   60,    0,
+       /* 8 */   60,    0,    0,    0,    0,    0,   60,   60,
     },
     [KNIGHT] = {
-       /*       A    B    C    D    E    F    G    H    */
-       /* 1 */ 0.5, 0.7, 0.8, 0.8, 0.8, 0.8, 0.7, 0.5, 
-       /* 2 */ 0.6, 0.7, 0.9, 0.9, 0.9, 0.9, 0.7, 0.6, 
-       /* 3 */ 0.6, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 0.6, 
-       /* 4 */ 0.6, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 0.6, 
-       /* 5 */ 0.6, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 0.6, 
-       /* 6 */ 0.6, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 0.6, 
-       /* 7 */ 0.6, 0.7, 0.9, 0.9, 0.9, 0.9, 0.7, 0.6, 
-       /* 8 */ 0.5, 0.7, 0.8, 0.8, 0.8, 0.8, 0.7, 0.5, 
+       /*       A     B     C     D     E     F     G     H  */
+       /* 1 */ -150,  -90,  -60,  -60,  -60,  -60,  -90, -150,
+       /* 2 */ -120,  -90,  -30,  -30,  -30,  -30,  -90, -120,
+       /* 3 */ -120,    0,    0,    0,    0,    0,    0, -120,
+       /* 4 */ -120,    0,    0,    0,    0,    0,    0, -120,
+       /* 5 */ -120,    0,    0,    0,    0,    0,    0, -120,
+       /* 6 */ -120,    0,    0,    0,    0,    0,    0, -120,
+       /* 7 */ -120,  -90,  -30,  -30,  -30,  -30,  -90, -120,
+       /* 8 */ -150,  -90,  -60,  -60,  -60,  -60,  -90, -150,
     },
     [ROOK] = {
-       /*       A    B    C    D    E    F    G    H    */
-       /* 1 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
-       /* 2 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
-       /* 3 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
-       /* 4 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
-       /* 5 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
-       /* 6 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
-       /* 7 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
-       /* 8 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
+       /*       A     B     C     D     E     F     G     H  */
+       /* 1 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 2 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 3 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 4 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 5 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 6 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 7 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 8 */    0,    0,    0,    0,    0,    0,    0,    0,
     },
     [QUEEN] = {
-       /*       A    B    C    D    E    F    G    H    */
-       /* 1 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
-       /* 2 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
-       /* 3 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
-       /* 4 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
-       /* 5 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
-       /* 6 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
-       /* 7 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
-       /* 8 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 
+       /*       A     B     C     D     E     F     G     H  */
+       /* 1 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 2 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 3 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 4 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 5 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 6 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 7 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 8 */    0,    0,    0,    0,    0,    0,    0,    0,
     },
     [KING] = {
-       /*       A    B    C    D    E    F    G    H    */
-       /* 1 */ 1.1, 1.1, 1.1, 1.0, 1.0, 1.0, 1.3,  1.15, 
-       /* 2 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0,  1.0, 
-       /* 3 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0,  1.0, 
-       /* 4 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0,  1.0, 
-       /* 5 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0,  1.0, 
-       /* 6 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0,  1.0, 
-       /* 7 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0,  1.0, 
-       /* 8 */ 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0,  1.0, 
+       /*       A     B     C     D     E     F     G     H  */
+       /* 1 */  100,  100,  100,    0,    0,    0,  300,  150,
+       /* 2 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 3 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 4 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 5 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 6 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 7 */    0,    0,    0,    0,    0,    0,    0,    0,
+       /* 8 */    0,    0,    0,    0,    0,    0,    0,    0,
     },
 };
 
@@ -200,13 +270,30 @@ inline size_t attr_index(enum color color) {
     return color == WHITE ? ATTR_WHITE : ATTR_BLACK;
 }
 
+/* Zobrist keys of the positions of a game so far, in a fixed ring that
+   keeps the last HISTORY_MAX of them. Only the positions since the last
+   capture or pawn move can repeat, and the game is drawn after 100 of
+   those, so older keys are never needed. */
+#define HISTORY_MAX 1024 /* a power of two */
+struct history {
+    uint64_t keys[HISTORY_MAX];
+    size_t   n; /* positions pushed, including those that fell off the ring */
+};
+
 struct game_state {
     Board board;
+    bitmap_t pieces[PIECE_COUNT]; // tiles occupied by each piece type, either color
+    bitmap_t colors[2];           // tiles occupied by each color, see attr_index()
     uint32_t attr[2];
     int last_pawn_double_move_file;
-    int turns_without_captures;
+    int turns_without_captures; // plies since the last capture or pawn move
     int turns;
     enum color player;
+    uint64_t hash; // Zobrist key, kept up to date by move()
+    int32_t score; // material and piece-square bonus in centipawns for white, kept up to date by move()
+    const struct history* history; // the game up to and including this position, or NULL
+    bitmap_t attacks[2];   // tiles each color attacks, see threatmap(); valid if its bit is set in attacks_valid
+    uint8_t attacks_valid; // cleared by every board change, rebuilt lazily by threatmap()
 };
 // hacky solution to pass game state to sigint handler
 static struct game_state sigint_state_copy;
@@ -216,72 +303,123 @@ enum castle_type {
     CASTLE_QUEENSIDE = 2,
 };
 
-static bool board_equals(Board* b1, Board* b2)
+/* The set of positions a game went through, with how often each occurred.
+   Slots are probed linearly in one flat array, sized up front for the
+   number of positions expected so a game never allocates. Should more come,
+   growing rehashes into an array twice the size. A slot only counts if it
+   carries the current generation, so boardset_clear() empties the set in
+   O(1) by bumping the generation. */
+struct boardset_slot {
+    uint64_t key;
+    uint32_t count;
+    uint32_t generation;
+};
+
+struct boardset {
+    struct boardset_slot* slots;
+    size_t                capacity; /* a power of two */
+    size_t                n;
+    uint32_t              generation;
+};
+
+#define BOARDSET_MIN_SLOTS  256
+
+/* zeroed slots, which carry generation 0 and so are all empty */
+static struct boardset_slot* boardset_alloc(size_t capacity)
 {
-	return memcmp(b1, b2, sizeof *b1) == 0;
+    struct boardset_slot* slots = calloc(capacity, sizeof *slots);
+    if (slots == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    return slots;
 }
 
-static size_t board_hash(Board* b)
+/* sets up an empty set with room for `expected` positions before it grows */
+static void boardset_init(struct boardset* bs, size_t expected)
 {
-	size_t n = 5381;
-	for (int i=0; i<BOARD_SIZE; i++) {
-		n = n*33+(size_t)b[i];
-	}
-	return n;
+    bs->capacity = BOARDSET_MIN_SLOTS;
+    while (bs->capacity < 2 * expected)
+        bs->capacity *= 2;
+    bs->slots      = boardset_alloc(bs->capacity);
+    bs->n          = 0;
+    bs->generation = 1;
 }
 
-struct boardset_entry {
-	Board board;
-    int n;
-	struct boardset_entry* next;
-};
+static void boardset_free(struct boardset* bs)
+{
+    free(bs->slots);
+    bs->slots    = NULL;
+    bs->capacity = 0;
+    bs->n        = 0;
+}
 
-struct boardset {
-	struct boardset_entry* entries[SET_SIZE];
-};
+static void boardset_clear(struct boardset* bs)
+{
+    bs->generation++;
+    bs->n = 0;
+}
 
-static void boardset_reset(struct boardset* bs)
+/* the slot holding `key`, or the empty one it would go in */
+static inline struct boardset_slot* boardset_find(struct boardset* bs, uint64_t key)
 {
-    for (size_t i=0; i < sizeof bs->entries / sizeof *(bs->entries); i++) {
-        struct boardset_entry* next, *e = bs->entries[i];
-        while (e) {
-            next = e->next;
-            free(e->board);
-            free(e);
-            e = next;
-        }
+    const size_t mask = bs->capacity - 1;
+    for (size_t i = key & mask;; i = (i + 1) & mask) {
+        struct boardset_slot* slot = &bs->slots[i];
+        if (slot->generation != bs->generation || slot->key == key)
+            return slot;
     }
 }
 
-static struct boardset_entry* boardset_get(struct boardset* bs, Board* b)
+static void boardset_grow(struct boardset* bs)
 {
-	size_t i = board_hash(b) % SET_SIZE;
+    struct boardset_slot* old      = bs->slots;
+    const size_t          capacity = bs->capacity;
+
+    bs->capacity *= 2;
+    bs->slots     = boardset_alloc(bs->capacity);
+    for (size_t i = 0; i < capacity; i++) {
+        if (old[i].generation == bs->generation)
+            *boardset_find(bs, old[i].key) = old[i];
+    }
+    free(old);
+}
 
-	struct boardset_entry** bsentry = &(bs->entries[i]);
+static int boardset_count(struct boardset* bs, struct game_state* g)
+{
+    const struct boardset_slot* slot = boardset_find(bs, g->hash);
+    return slot->generation == bs->generation ? (int)slot->count : 0;
+}
 
-	while (*bsentry != NULL && !board_equals(b, &((*bsentry)->board))) {
-        *bsentry = (*bsentry)->next;
-	}
+/* counts another occurrence of the position, returns how often it has occurred */
+static int boardset_inc(struct boardset* bs, struct game_state* g)
+{
+    if (2 * (bs->n + 1) > bs->capacity)
+        boardset_grow(bs);
 
-    if (*bsentry == NULL) {
-        *bsentry = calloc(sizeof *bsentry, 1);
-        if (bsentry == NULL) {
-            perror("malloc");
-            exit(EXIT_FAILURE);
-        }
+    struct boardset_slot* slot = boardset_find(bs, g->hash);
+    if (slot->generation != bs->generation) {
+        *slot = (struct boardset_slot){ .key = g->hash, .count = 0, .generation = bs->generation };
+        bs->n++;
     }
+    return (int)++slot->count;
+}
 
-    return *bsentry;
+static void history_push(struct history* h, uint64_t key)
+{
+    h->keys[h->n++ & (HISTORY_MAX - 1)] = key;
 }
 
-int boardset_count(struct boardset* bs, Board* b)
+/* whether the position `back` plies before the last one is still kept */
+static inline bool history_has(const struct history* h, size_t back)
 {
-    return boardset_get(bs, b)->n;
+    return back < h->n && back < HISTORY_MAX;
 }
 
-void boardset_inc(struct boardset* bs, Board* b)
+/* the key of the position `back` plies before the last one, see history_has() */
+static inline uint64_t history_key(const struct history* h, size_t back)
 {
-    boardset_get(bs, b)->n += 1;
+    return h->keys[(h->n - 1 - back) & (HISTORY_MAX - 1)];
 }
 
 
@@ -290,6 +428,14 @@ static inline bitmap_t bit(index_t i)
     return 1UL << i;
 }
 
+/* returns the index of the lowest set bit and clears it */
+static inline index_t pop_lsb(bitmap_t* b)
+{
+    const index_t i = __builtin_ctzll(*b);
+    *b &= *b - 1;
+    return i;
+}
+
 static inline bool friends(piece_t a, piece_t b)
 {
     return a * b > 0;
@@ -389,28 +535,243 @@ static void paint_board(struct game_state* g, index_t highlight1, index_t highli
     printf("\n");
 }
 
-static void move(struct game_state* g, index_t from, index_t to)
+/* xorshift64* pseudo random number generator, used to build tables at startup */
+static uint64_t random_u64(uint64_t* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/* Zobrist hashing: every piece on every tile, every combination of castling
+   rights, every en passant file and the side to move gets a random key, and
+   a position's hash is the xor of the keys that apply to it.
+   https://www.chessprogramming.org/Zobrist_Hashing */
+static uint64_t zobrist_pieces[2][PIECE_COUNT][BOARD_SIZE];
+static uint64_t zobrist_castling[16];
+static uint64_t zobrist_en_passant[8];
+static uint64_t zobrist_black_to_move;
+
+static void init_zobrist(void)
+{
+    uint64_t seed = 0x2C0B2A5E5D1C4C57ULL;
+
+    for (int c = 0; c < 2; c++)
+        for (int p = 0; p < PIECE_COUNT; p++)
+            for (index_t i = 0; i < BOARD_SIZE; i++)
+                zobrist_pieces[c][p][i] = p == EMPTY ? 0 : random_u64(&seed);
+    for (size_t i = 0; i < 16; i++)
+        zobrist_castling[i] = random_u64(&seed);
+    for (size_t i = 0; i < 8; i++)
+        zobrist_en_passant[i] = random_u64(&seed);
+    zobrist_black_to_move = random_u64(&seed);
+}
+
+/* castling rights as a 4 bit mask, the white castle_type bits in the low
+   half and the black ones in the high half */
+static unsigned castling_rights(struct game_state* g)
+{
+    unsigned rights = 0;
+    for (int p = ATTR_WHITE; p <= ATTR_BLACK; p++) {
+        if (g->attr[p] & KING_TOUCHED)
+            continue;
+        if (!(g->attr[p] & H_ROOK_TOUCHED))
+            rights |= CASTLE_KINGSIDE << (2*p);
+        if (!(g->attr[p] & A_ROOK_TOUCHED))
+            rights |= CASTLE_QUEENSIDE << (2*p);
+    }
+    return rights;
+}
+
+/* hash of the castling rights, en passant file and side to move */
+static inline uint64_t zobrist_state(struct game_state* g)
+{
+    uint64_t h = zobrist_castling[castling_rights(g)];
+    if (g->last_pawn_double_move_file != -1)
+        h ^= zobrist_en_passant[g->last_pawn_double_move_file];
+    if (g->player == BLACK)
+        h ^= zobrist_black_to_move;
+    return h;
+}
+
+/* computes the hash of a position from scratch, move() updates it incrementally */
+static uint64_t zobrist_hash(struct game_state* g)
+{
+    uint64_t h = zobrist_state(g);
+    for (index_t i = 0; i < BOARD_SIZE; i++) {
+        const piece_t piece = g->board[i];
+        h ^= zobrist_pieces[attr_index(piece_color(piece))][piece_abs(piece)][i];
+    }
+    return h;
+}
+
+/* piece_value[] plus piece_square_bonus[] for each color and tile, negated for
+   black, so a position's score is the sum over its pieces. Aligned so the
+   vector evaluators below can load a row 16 tiles at a time. */
+static _Alignas(32) int16_t piece_square[2][PIECE_COUNT][BOARD_SIZE];
+
+/* Scores `n` whole boards, for game_refresh() and for anything that
+   evaluates boards in bulk. init_piece_square() points it at the fastest
+   of the versions below the CPU runs. */
+static void (*board_scores)(const Board* boards, int32_t* scores, size_t n);
+
+static void board_scores_scalar(const Board* boards, int32_t* scores, size_t n)
+{
+    for (size_t b = 0; b < n; b++) {
+        int32_t score = 0;
+        for (index_t i = 0; i < BOARD_SIZE; i++) {
+            const piece_t piece = boards[b][i];
+            score += piece_square[attr_index(piece_color(piece))][piece_abs(piece)][i];
+        }
+        scores[b] = score;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* The board is read as 64 signed bytes and widened to 16 bits a few tiles
+   at a time. For each piece a compare with it and with its negation gives
+   masks of -1 on the tiles it stands on for either color, and multiply-adding
+   a mask with the piece's row of piece_square[] sums its values over those
+   tiles in 32 bit pairs. The masks being -1, the sums are subtracted. */
+__attribute__((target("avx2")))
+static void board_scores_avx2(const Board* boards, int32_t* scores, size_t n)
+{
+    for (size_t b = 0; b < n; b++) {
+        __m256i sum = _mm256_setzero_si256();
+        for (index_t i = 0; i < BOARD_SIZE; i += 16) {
+            const __m256i tiles = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)&boards[b][i]));
+            for (int p = KING; p <= PAWN; p++) {
+                const __m256i white = _mm256_cmpeq_epi16(tiles, _mm256_set1_epi16(p));
+                const __m256i black = _mm256_cmpeq_epi16(tiles, _mm256_set1_epi16(-p));
+                sum = _mm256_sub_epi32(sum, _mm256_madd_epi16(white, _mm256_load_si256((const __m256i*)&piece_square[ATTR_WHITE][p][i])));
+                sum = _mm256_sub_epi32(sum, _mm256_madd_epi16(black, _mm256_load_si256((const __m256i*)&piece_square[ATTR_BLACK][p][i])));
+            }
+        }
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        s = _mm_hadd_epi32(s, s);
+        s = _mm_hadd_epi32(s, s);
+        scores[b] = _mm_cvtsi128_si32(s);
+    }
+}
+
+/* board_scores_avx2() 8 tiles at a time */
+__attribute__((target("sse4.1")))
+static void board_scores_sse4(const Board* boards, int32_t* scores, size_t n)
+{
+    for (size_t b = 0; b < n; b++) {
+        __m128i sum = _mm_setzero_si128();
+        for (index_t i = 0; i < BOARD_SIZE; i += 8) {
+            const __m128i tiles = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*)&boards[b][i]));
+            for (int p = KING; p <= PAWN; p++) {
+                const __m128i white = _mm_cmpeq_epi16(tiles, _mm_set1_epi16(p));
+                const __m128i black = _mm_cmpeq_epi16(tiles, _mm_set1_epi16(-p));
+                sum = _mm_sub_epi32(sum, _mm_madd_epi16(white, _mm_load_si128((const __m128i*)&piece_square[ATTR_WHITE][p][i])));
+                sum = _mm_sub_epi32(sum, _mm_madd_epi16(black, _mm_load_si128((const __m128i*)&piece_square[ATTR_BLACK][p][i])));
+            }
+        }
+        sum = _mm_hadd_epi32(sum, sum);
+        sum = _mm_hadd_epi32(sum, sum);
+        scores[b] = _mm_cvtsi128_si32(sum);
+    }
+}
+#endif
+
+static void init_piece_square(void)
+{
+    for (int p = 0; p < PIECE_COUNT; p++) {
+        for (index_t i = 0; i < BOARD_SIZE; i++) {
+            piece_square[ATTR_WHITE][p][i] =   piece_value[p] + piece_square_bonus[p][i];
+            piece_square[ATTR_BLACK][p][i] = -(piece_value[p] + piece_square_bonus[p][i ^ 56]);
+        }
+    }
+
+    board_scores = board_scores_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        board_scores = board_scores_avx2;
+    else if (__builtin_cpu_supports("sse4.1"))
+        board_scores = board_scores_sse4;
+#endif
+}
+
+/* computes the score of a position from scratch, move() updates it incrementally */
+static int32_t material_score(struct game_state* g)
+{
+    int32_t score;
+    board_scores((const Board*)&g->board, &score, 1);
+    return score;
+}
+
+/* places `piece` on tile `i`, keeping the bitmaps, hash and score in sync with the board */
+static inline void set_tile(struct game_state* g, index_t i, piece_t piece)
+{
+    const piece_t old = g->board[i];
+
+    g->hash ^= zobrist_pieces[attr_index(piece_color(old))][piece_abs(old)][i]
+             ^ zobrist_pieces[attr_index(piece_color(piece))][piece_abs(piece)][i];
+    g->score += piece_square[attr_index(piece_color(piece))][piece_abs(piece)][i]
+              - piece_square[attr_index(piece_color(old))][piece_abs(old)][i];
+
+    if (old != EMPTY) {
+        g->pieces[piece_abs(old)]               &= ~bit(i);
+        g->colors[attr_index(piece_color(old))] &= ~bit(i);
+    }
+    if (piece != EMPTY) {
+        g->pieces[piece_abs(piece)]               |= bit(i);
+        g->colors[attr_index(piece_color(piece))] |= bit(i);
+    }
+    g->board[i] = piece;
+    g->attacks_valid = 0;
+}
+
+/* What move() can't recompute when taking a move back, see unmove() */
+struct undo {
+    uint64_t hash;
+    uint32_t attr[2];
+    int      last_pawn_double_move_file;
+    int      turns_without_captures;
+    piece_t  moved;    /* the piece that moved, a pawn if it promoted */
+    piece_t  captured; /* what was on the destination tile */
+};
+
+static struct undo move(struct game_state* g, move_t m)
 {
     static_assert(WHITE == 1,  "`WHITE` must match direction of white pawns (1) for move() to work");
     static_assert(BLACK == -1, "`BLACK` must match direction of black pawns (-1) for move() to work");
 
+    const index_t from = move_from(m);
+    const index_t to   = move_to(m);
     const int piece = piece_abs(g->board[from]);
     const enum color player = g->player;
     const int p = attr_index(player);
+    const int en_passant_file = g->last_pawn_double_move_file;
+
+    const struct undo u = {
+        .hash                       = g->hash,
+        .attr                       = { g->attr[0], g->attr[1] },
+        .last_pawn_double_move_file = g->last_pawn_double_move_file,
+        .turns_without_captures     = g->turns_without_captures,
+        .moved                      = g->board[from],
+        .captured                   = g->board[to],
+    };
+
+    g->hash ^= zobrist_state(g);
 
     g->turns  += 1;
     g->player *= -1;
     g->last_pawn_double_move_file = -1;
 
-    if (from == A8 || to == A8) {
+    // a move from or to a corner means that rook can no longer castle
+    if (from == A8 || to == A8)
         g->attr[ATTR_BLACK] |= A_ROOK_TOUCHED;
-    } else if (from == A1 || to == A1) {
+    if (from == A1 || to == A1)
         g->attr[ATTR_WHITE] |= A_ROOK_TOUCHED;
-    } else if (from == H1 || to == H1) {
+    if (from == H1 || to == H1)
         g->attr[ATTR_WHITE] |= H_ROOK_TOUCHED;
-    } else if (from == H8 || to == H8) {
+    if (from == H8 || to == H8)
         g->attr[ATTR_BLACK] |= H_ROOK_TOUCHED;
-    }
 
     if (g->board[to] == EMPTY) {
         g->turns_without_captures += 1;
@@ -425,204 +786,235 @@ static void move(struct game_state* g, index_t from, index_t to)
         g->attr[p] |= KING_TOUCHED;
 
         // castling
-        if (player == WHITE && to == G1) {
-            g->board[F1] = ROOK;
-            g->board[H1] = EMPTY;
-        } else if (player == BLACK && to == G8) {
-            g->board[F8] = -ROOK;
-            g->board[H8] = EMPTY;
-        } else if (player == WHITE && to == C1) {
-            g->board[A1] = EMPTY;
-            g->board[B1] = EMPTY;
-            g->board[D1] = ROOK;
-        } else if (player == BLACK && to == C8) {
-            g->board[A8] = EMPTY;
-            g->board[B8] = EMPTY;
-            g->board[D8] = -ROOK;
-        }
-        g->board[to]   = g->board[from];
-        g->board[from] = EMPTY;
-        return;
+        if (from == E1 && to == G1) {
+            set_tile(g, F1, ROOK);
+            set_tile(g, H1, EMPTY);
+        } else if (from == E8 && to == G8) {
+            set_tile(g, F8, -ROOK);
+            set_tile(g, H8, EMPTY);
+        } else if (from == E1 && to == C1) {
+            set_tile(g, A1, EMPTY);
+            set_tile(g, D1, ROOK);
+        } else if (from == E8 && to == C8) {
+            set_tile(g, A8, EMPTY);
+            set_tile(g, D8, -ROOK);
+        }
+        set_tile(g, to, g->board[from]);
+        set_tile(g, from, EMPTY);
     }
     // en passent
     else if (piece == PAWN) {
-        if (g->last_pawn_double_move_file == file(to)) {
-            g->board[to-RANK * player] = EMPTY;
+        // pawn moves can't be undone either, so they restart the count
+        g->turns_without_captures = 0;
+        if (file(to) != file(from) && g->board[to] == EMPTY) {
+            assert(file(to) == en_passant_file);
+            set_tile(g, to - RANK*player, EMPTY);
         }
         if (to - from == 2*RANK * player) {
             g->last_pawn_double_move_file = file(to);
         }
 
         if (rank(to) == RANK_1 || rank(to) == RANK_8) {
-            // promotion, TODO: implement other promotions
-            g->board[to] = player * QUEEN;
+            const enum chess_piece promotion = move_promotion(m);
+            set_tile(g, to, player * (promotion == EMPTY ? QUEEN : promotion));
         } else {
-            g->board[to] = g->board[from];
+            set_tile(g, to, g->board[from]);
         }
-        g->board[from] = EMPTY;
+        set_tile(g, from, EMPTY);
     } else {
-        g->board[to]   = g->board[from];
-        g->board[from] = EMPTY;
+        set_tile(g, to, g->board[from]);
+        set_tile(g, from, EMPTY);
     }
+
+    g->hash ^= zobrist_state(g);
+    return u;
 }
 
-static bitmap_t pawn_threatmap(struct game_state* g, index_t index)
+/* takes back move `m`, which must be the last move made and have returned `u` */
+static void unmove(struct game_state* g, move_t m, const struct undo* u)
 {
-    const index_t left  = bit(index + RANK*g->player - 1);
-    const index_t right = bit(index + RANK*g->player + 1);
+    const index_t from = move_from(m);
+    const index_t to   = move_to(m);
+
+    g->turns  -= 1;
+    g->player *= -1;
 
-    if (file(index) == FILE_A)
-        return right;
+    const enum color player = g->player;
 
-    if (file(index) == FILE_H)
-        return left;
+    set_tile(g, from, u->moved);
+    set_tile(g, to, u->captured);
+
+    if (piece_abs(u->moved) == PAWN && file(to) != file(from) && u->captured == EMPTY) {
+        set_tile(g, to - RANK*player, -player * PAWN);
+    } else if (piece_abs(u->moved) == KING && to - from == 2) {
+        set_tile(g, to - 1, EMPTY);
+        set_tile(g, to + 1, player * ROOK);
+    } else if (piece_abs(u->moved) == KING && from - to == 2) {
+        set_tile(g, to + 1, EMPTY);
+        set_tile(g, to - 2, player * ROOK);
+    }
 
-    return left | right;
+    g->hash                       = u->hash;
+    g->attr[0]                    = u->attr[0];
+    g->attr[1]                    = u->attr[1];
+    g->last_pawn_double_move_file = u->last_pawn_double_move_file;
+    g->turns_without_captures     = u->turns_without_captures;
 }
 
-static bitmap_t diagonal_threatmap(struct game_state* g, index_t index)
+/* tiles attacked by all `pawns` of `color` at once */
+static inline bitmap_t pawn_attacks(bitmap_t pawns, enum color color)
 {
-    bitmap_t threatened = 0;
+    if (color == WHITE)
+        return ((pawns << 7) & ~FILE_H_BITMAP) | ((pawns << 9) & ~FILE_A_BITMAP);
+    return ((pawns >> 9) & ~FILE_H_BITMAP) | ((pawns >> 7) & ~FILE_A_BITMAP);
+}
 
-    //index_t directions[] = { RANK+1, RANK-1, -RANK+1, -RANK-1 };
+/* tiles attacked by all `knights` at once */
+static inline bitmap_t knight_attacks(bitmap_t knights)
+{
+    const bitmap_t l1 = (knights >> 1) & ~FILE_H_BITMAP;
+    const bitmap_t l2 = (knights >> 2) & ~(FILE_H_BITMAP | FILE_H_BITMAP >> 1);
+    const bitmap_t r1 = (knights << 1) & ~FILE_A_BITMAP;
+    const bitmap_t r2 = (knights << 2) & ~(FILE_A_BITMAP | FILE_A_BITMAP << 1);
+    const bitmap_t h1 = l1 | r1;
+    const bitmap_t h2 = l2 | r2;
+    return (h1 << 16) | (h1 >> 16) | (h2 << 8) | (h2 >> 8);
+}
 
-    for (index_t i = index+RANK+1; i < BOARD_SIZE && file(i-1) != 7; i += RANK+1) {
-        threatened |= bit(i);
-        if (g->board[i] != EMPTY) {
-            break;
-        }
-    }
-    for (index_t i = index+RANK-1; i < BOARD_SIZE && file(i+1) != 0; i += RANK-1) {
-        threatened |= bit(i);
-        if (g->board[i] != EMPTY) {
-            break;
-        }
-    }
-    for (index_t i = index-RANK+1; i >= 0 && file(i-1) != 7; i += -RANK+1) {
-        threatened |= bit(i);
-        if (g->board[i] != EMPTY) {
-            break;
-        }
-    }
-    for (index_t i = index-RANK-1; i >= 0 && file(i+1) != 0; i += -RANK-1) {
-        threatened |= bit(i);
-        if (g->board[i] != EMPTY) {
-            break;
-        }
+static bitmap_t king_attack_table[BOARD_SIZE];
+
+static void init_king_attacks(void)
+{
+    for (index_t i = 0; i < BOARD_SIZE; i++) {
+        const bitmap_t b = bit(i);
+        const bitmap_t row = b | ((b << 1) & ~FILE_A_BITMAP) | ((b >> 1) & ~FILE_H_BITMAP);
+        king_attack_table[i] = (row | row << 8 | row >> 8) & ~b;
     }
-    return threatened;
 }
 
-static bitmap_t cardinal_threatmap(struct game_state* g, index_t index)
+static inline bitmap_t pawn_threatmap(struct game_state* g, index_t index)
+{
+    return pawn_attacks(bit(index), piece_color(g->board[index]));
+}
+
+/* Sliding attacks are looked up with "fancy" magic bitboards: the blockers on
+   a piece's rays are masked out of the occupancy, multiplied by a magic number
+   and shifted so the top bits index a table of precomputed attack sets.
+   https://www.chessprogramming.org/Magic_Bitboards */
+struct magic {
+    bitmap_t  mask;
+    bitmap_t  magic;
+    bitmap_t* attacks;
+    unsigned  shift;
+};
+
+static struct magic bishop_magics[BOARD_SIZE];
+static struct magic rook_magics[BOARD_SIZE];
+static bitmap_t     bishop_attack_table[0x1480];
+static bitmap_t     rook_attack_table[0x19000];
+
+static const index_t bishop_directions[4][2] = { {1, 1}, {1, -1}, {-1, 1}, {-1, -1} };
+static const index_t rook_directions[4][2]   = { {1, 0}, {-1, 0}, {0, 1}, {0, -1} };
+
+/* walks each ray one tile at a time, only used to fill the magic tables */
+static bitmap_t ray_attacks(index_t index, bitmap_t occupied, const index_t directions[4][2])
 {
     bitmap_t threatened = 0;
 
-    for (index_t i = index+RANK; i < BOARD_SIZE; i += RANK) {
-        threatened |= bit(i);
-        if (g->board[i] != EMPTY)
-            break;
-    }
-    for (index_t i = index-RANK; i >= 0; i -= RANK) {
-        threatened |= bit(i);
-        if (g->board[i] != EMPTY)
-            break;
-    }
-    for (index_t i = index+1; i < BOARD_SIZE && file(i) != 0; i++) {
-        threatened |= bit(i);
-        if (g->board[i] != EMPTY)
-            break;
-    }
-    for (index_t i = index-1; i > 0 && file(i) != 7; i--) {
-        threatened |= bit(i);
-        if (g->board[i] != EMPTY)
-            break;
+    for (int d = 0; d < 4; d++) {
+        index_t f = file(index) + directions[d][0];
+        index_t r = index / RANK + directions[d][1];
+        while (f >= 0 && f < 8 && r >= 0 && r < 8) {
+            threatened |= bit(r*RANK + f);
+            if (occupied & bit(r*RANK + f))
+                break;
+            f += directions[d][0];
+            r += directions[d][1];
+        }
     }
-
     return threatened;
 }
 
-static inline bitmap_t bishop_threatmap(struct game_state* g, index_t index)
+static inline size_t magic_index(const struct magic* m, bitmap_t occupied)
 {
-    return diagonal_threatmap(g, index);
+    return ((occupied & m->mask) * m->magic) >> m->shift;
 }
 
-static inline bitmap_t rook_threatmap(struct game_state* g, index_t index)
+static void init_magics(struct magic magics[BOARD_SIZE],
+                        bitmap_t* table,
+                        const index_t directions[4][2])
 {
-    return cardinal_threatmap(g, index);
+    /* seeds per rank known to find magics quickly with random_u64() */
+    static const uint64_t seeds[8] = { 728, 10316, 55013, 32803, 12281, 15100, 16645, 255 };
+    static bitmap_t       occupancy[4096], reference[4096];
+    static int            epoch[4096], attempt = 0;
+    bitmap_t*             attacks = table;
+
+    for (index_t sq = 0; sq < BOARD_SIZE; sq++) {
+        struct magic* m = &magics[sq];
+        uint64_t seed = seeds[sq / RANK];
+
+        /* blockers on the edge of the board never change the attack set */
+        const bitmap_t edges = ((RANK_1_BITMAP | RANK_8_BITMAP) & ~(RANK_1_BITMAP << rank(sq)))
+                             | ((FILE_A_BITMAP | FILE_H_BITMAP) & ~(FILE_A_BITMAP << file(sq)));
+
+        m->mask    = ray_attacks(sq, 0, directions) & ~edges;
+        m->shift   = 64 - __builtin_popcountll(m->mask);
+        m->attacks = attacks;
+
+        /* enumerate every subset of the mask with the carry-rippler trick */
+        size_t size = 0;
+        bitmap_t b = 0;
+        do {
+            occupancy[size] = b;
+            reference[size] = ray_attacks(sq, b, directions);
+            size++;
+            b = (b - m->mask) & m->mask;
+        } while (b);
+
+        for (size_t i = 0; i < size; ) {
+            do {
+                m->magic = random_u64(&seed) & random_u64(&seed) & random_u64(&seed);
+            } while (__builtin_popcountll((m->mask * m->magic) >> 56) < 6);
+
+            attempt++;
+            for (i = 0; i < size; i++) {
+                const size_t idx = magic_index(m, occupancy[i]);
+                if (epoch[idx] < attempt) {
+                    epoch[idx] = attempt;
+                    m->attacks[idx] = reference[i];
+                } else if (m->attacks[idx] != reference[i]) {
+                    break;
+                }
+            }
+        }
+        attacks += size;
+    }
 }
 
-static bitmap_t knight_threatmap(index_t index)
+static inline bitmap_t bishop_threatmap(bitmap_t occupied, index_t index)
 {
-    bitmap_t threatened = 0L;
-
-    //clang-format off
-    index_t knight_wheel[8*2] = {
-     /*  x,   y  */
-         1,   2*RANK,
-         1,  -2*RANK,
-        -1,   2*RANK,
-        -1,  -2*RANK,
-         2,   1*RANK,
-         2,  -1*RANK,
-        -2,   1*RANK,
-        -2,  -1*RANK
-    };
-    // clang-format on
-    
-    for (size_t i = 0; i < sizeof knight_wheel / sizeof knight_wheel[0]; i += 2) {
-        if (file(index) + knight_wheel[i] < FILE_A
-         || file(index) + knight_wheel[i] > FILE_H
-         || rank(index) + knight_wheel[i+1] < RANK_1
-         || rank(index) + knight_wheel[i+1] > RANK_8)
-            continue;
+    return bishop_magics[index].attacks[magic_index(&bishop_magics[index], occupied)];
+}
 
-        threatened |= bit(index + knight_wheel[i] + knight_wheel[i+1]);
-    }
+static inline bitmap_t rook_threatmap(bitmap_t occupied, index_t index)
+{
+    return rook_magics[index].attacks[magic_index(&rook_magics[index], occupied)];
+}
 
-    return threatened;
+static inline bitmap_t knight_threatmap(index_t index)
+{
+    return knight_attacks(bit(index));
 }
 
-static bitmap_t king_threatmap(index_t index)
+static inline bitmap_t king_threatmap(index_t index)
 {
-    // I fucking hate this function so much
-    if (rank(index) == RANK_1) {
-        if (file(index) == FILE_A) {
-            return bit(index+1) | bit(index+RANK+1) | bit (index+RANK);
-        }
-        else if (file(index) == FILE_H) {
-            return bit(index-1) | bit(index+RANK-1) | bit (index+RANK);
-        }
-        else {
-            return bit(index-1) | bit(index+1) | bit(index+RANK-1) | bit(index+RANK) | bit(index+RANK+1);
-        }
-    }
-    if (rank(index) == RANK_8) {
-        if (file(index) == FILE_A) {
-            return bit(index+1) | bit(index-RANK+1) | bit (index-RANK);
-        }
-        else if (file(index) == FILE_H) {
-            return bit(index-1) | bit(index-RANK-1) | bit (index-RANK);
-        }
-        else {
-            return bit(index-1) | bit(index+1) | bit(index-RANK-1) | bit(index-RANK) | bit(index-RANK+1);
-        }
-    } else {
-        if (file(index) == FILE_A) {
-            return bit(index-RANK) | bit(index-RANK+1) | bit(index+1) | bit(index+RANK+1) | bit(index+RANK);
-        }
-        else if (file(index) == FILE_H) {
-            return bit(index-RANK) | bit(index-RANK-1) | bit(index-1) | bit(index+RANK-1) | bit(index+RANK);
-        } else {
-            return bit(index-RANK-1) | bit(index-RANK) | bit(index-RANK+1)
-                 | bit(index-1)                        | bit(index+1)
-                 | bit(index+RANK-1) | bit(index+RANK) | bit(index+RANK+1);
-        }
-    }
+    return king_attack_table[index];
 }
 
-static inline bitmap_t queen_threatmap(struct game_state* g, index_t index)
-{   
-    return diagonal_threatmap(g, index) | cardinal_threatmap(g, index);
+static inline bitmap_t queen_threatmap(bitmap_t occupied, index_t index)
+{
+    return bishop_threatmap(occupied, index) | rook_threatmap(occupied, index);
 }
 
 static void print_threatmap(bitmap_t threatmap)
@@ -644,7 +1036,12 @@ static void print_threatmap(bitmap_t threatmap)
     fputc('\n', stdout);
 }
 
-static bitmap_t piece_threatmap(struct game_state* g, index_t index)
+static inline bitmap_t occupancy(struct game_state* g)
+{
+    return g->colors[ATTR_WHITE] | g->colors[ATTR_BLACK];
+}
+
+static bitmap_t piece_threatmap(struct game_state* g, index_t index, bitmap_t occupied)
 {
     switch (piece_abs(g->board[index])) {
     case EMPTY:
@@ -652,446 +1049,3203 @@ static bitmap_t piece_threatmap(struct game_state* g, index_t index)
     case PAWN:
         return pawn_threatmap(g, index);
     case BISHOP:
-        return bishop_threatmap(g, index);
+        return bishop_threatmap(occupied, index);
     case ROOK:
-        return rook_threatmap(g, index);
+        return rook_threatmap(occupied, index);
     case KNIGHT:
         return knight_threatmap(index);
     case KING:
         return king_threatmap(index);
     case QUEEN:
-        return queen_threatmap(g, index);
+        return queen_threatmap(occupied, index);
     default:
         return 0L;
     }
 }
 
+/* every tile `attacker` attacks, cached in the game state until the board changes */
 static bitmap_t threatmap(struct game_state* g, enum color attacker)
 {
-    enum color p = g->player;
-    g->player = attacker;
-    bitmap_t t = 0;
-    for(index_t i = 0; i < BOARD_SIZE; i++) {
-        if (friends(g->board[i], attacker)) {
-            t |= piece_threatmap(g, i);
-        }
-    }
-    g->player = p;
-    return t;
-}
+    const int a = attr_index(attacker);
+    if (g->attacks_valid & (1 << a))
+        return g->attacks[a];
 
-static bool pawn_move_ok(struct game_state* g, index_t from, index_t to)
-{
-    //printf("checking pawn move for %s\n", g->player == WHITE ? "WHITE" : "BLACK");
-    const index_t diff = (to - from) * g->player;
-    const index_t starting_rank = g->player == WHITE ? RANK_2 : RANK_7;
+    const bitmap_t occupied = occupancy(g);
+    const bitmap_t own      = g->colors[attr_index(attacker)];
 
-    switch (diff) {
-    case RANK: /* single move */
-        return g->board[to] == EMPTY;
+    bitmap_t t = pawn_attacks(g->pieces[PAWN] & own, attacker)
+               | knight_attacks(g->pieces[KNIGHT] & own)
+               | king_threatmap(g->attr[attr_index(attacker)] & KING_POSITION);
 
-    case RANK - COL: /* diagonal attack */
-    case RANK + COL:
-        if ((file(from) == FILE_A && file(to) == FILE_H)
-         || (file(from) == FILE_H && file(to) == FILE_A)
-        ) {
-            return false;
-        } else if (file(to) == g->last_pawn_double_move_file
-                && rank(from) == (g->player == WHITE ? RANK_5 : RANK_4)
-        ) {
-            return true;
-        } else {
-            return enemies(g->board[to], g->board[from]);
-        }
+    bitmap_t diagonal = (g->pieces[BISHOP] | g->pieces[QUEEN]) & own;
+    while (diagonal)
+        t |= bishop_threatmap(occupied, pop_lsb(&diagonal));
 
-    case 2 * RANK: /* double move */
-        return g->board[to] == EMPTY
-            && g->board[from + RANK*g->player] == EMPTY
-            && rank(from) == starting_rank;
+    bitmap_t cardinal = (g->pieces[ROOK] | g->pieces[QUEEN]) & own;
+    while (cardinal)
+        t |= rook_threatmap(occupied, pop_lsb(&cardinal));
 
-    default:
-        return false;
-    }
+    g->attacks[a]     = t;
+    g->attacks_valid |= 1 << a;
+    return t;
+}
+
+/* tiles of `color`'s pieces that attack tile `i` */
+static inline bitmap_t attackers(struct game_state* g, index_t i, bitmap_t occupied, enum color color)
+{
+    return ((pawn_attacks(bit(i), -color) & g->pieces[PAWN])
+          | (knight_threatmap(i) & g->pieces[KNIGHT])
+          | (king_threatmap(i) & g->pieces[KING])
+          | (bishop_threatmap(occupied, i) & (g->pieces[BISHOP] | g->pieces[QUEEN]))
+          | (rook_threatmap(occupied, i) & (g->pieces[ROOK] | g->pieces[QUEEN])))
+         & g->colors[attr_index(color)];
 }
 
 static bool is_check(struct game_state* g, enum color player)
 {
-    return bit(g->attr[attr_index(player)] & KING_POSITION) & threatmap(g, -player);
+    const index_t king = g->attr[attr_index(player)] & KING_POSITION;
+    if (g->attacks_valid & (1 << attr_index(-player)))
+        return g->attacks[attr_index(-player)] & bit(king);
+    return attackers(g, king, occupancy(g), -player) != 0;
 }
 
-static bool castle_kingside_ok(struct game_state* g)
+/* For two tiles on a rank, file or diagonal: the tiles strictly between
+   them, and the whole line through them. Zero for tiles not on a line. */
+static bitmap_t between_table[BOARD_SIZE][BOARD_SIZE];
+static bitmap_t line_table[BOARD_SIZE][BOARD_SIZE];
+
+static void init_lines(void)
 {
-    if (is_check(g, g->player)) {
-        return false;
+    for (index_t a = 0; a < BOARD_SIZE; a++) {
+        for (int d = 0; d < 8; d++) {
+            const index_t* dir = d < 4 ? bishop_directions[d] : rook_directions[d - 4];
+
+            /* the other half of the line runs the opposite way from `a` */
+            const bitmap_t line = ray_attacks(a, 0, (const index_t[4][2]){
+                { dir[0], dir[1] }, { -dir[0], -dir[1] }, { dir[0], dir[1] }, { dir[0], dir[1] } }) | bit(a);
+
+            bitmap_t between = 0;
+            index_t  f = file(a) + dir[0], r = a / RANK + dir[1];
+            for (; f >= 0 && f < 8 && r >= 0 && r < 8; f += dir[0], r += dir[1]) {
+                between_table[a][r*RANK + f] = between;
+                line_table[a][r*RANK + f]    = line;
+                between |= bit(r*RANK + f);
+            }
+        }
     }
+}
+
+static bool castle_kingside_ok(struct game_state* g)
+{
     const int p = attr_index(g->player);
     const int rank = g->player == WHITE ? RANK_1 : RANK_8;
 
-    return !(g->attr[p] & H_ROOK_TOUCHED)
-        && !(g->attr[p] & KING_TOUCHED)
-        && !(threatmap(g, -g->player) & (bit(FILE_F + rank) | bit(FILE_G + rank)))
-        && g->board[FILE_G + rank] == EMPTY
-        && g->board[FILE_F + rank] == EMPTY;
+    if ((g->attr[p] & H_ROOK_TOUCHED)
+     || (g->attr[p] & KING_TOUCHED)
+     || g->board[FILE_G + rank] != EMPTY
+     || g->board[FILE_F + rank] != EMPTY) {
+        return false;
+    }
+    return !(threatmap(g, -g->player) & (bit(FILE_E + rank) | bit(FILE_F + rank) | bit(FILE_G + rank)));
 }
 
 static bool castle_queenside_ok(struct game_state* g)
 {
-    if (is_check(g, g->player)) {
-        return false;
-    }
     const int p = attr_index(g->player);
     const int rank = g->player == WHITE ? RANK_1 : RANK_8;
-    return !(g->attr[p] & A_ROOK_TOUCHED)
-        && !(g->attr[p] & KING_TOUCHED)
-        && !(threatmap(g, -g->player) & (bit(FILE_C + rank) | bit(FILE_D + rank)))
-        && g->board[FILE_B + rank] == EMPTY
-        && g->board[FILE_C + rank] == EMPTY
-        && g->board[FILE_D + rank] == EMPTY;
+
+    if ((g->attr[p] & A_ROOK_TOUCHED)
+     || (g->attr[p] & KING_TOUCHED)
+     || g->board[FILE_B + rank] != EMPTY
+     || g->board[FILE_C + rank] != EMPTY
+     || g->board[FILE_D + rank] != EMPTY) {
+        return false;
+    }
+    return !(threatmap(g, -g->player) & (bit(FILE_C + rank) | bit(FILE_D + rank) | bit(FILE_E + rank)));
+}
+
+enum move_kind {
+    MOVES_ALL,
+    MOVES_CAPTURES, /* captures and queen promotions, for the quiescence search */
+};
+
+/* whether taking en passant leaves the king safe; the two pawns leaving
+   the same rank can uncover an attack no mask accounts for */
+static bool en_passant_ok(struct game_state* g, move_t m)
+{
+    const struct undo u = move(g, m);
+    const bool        ok = !is_check(g, -g->player);
+    unmove(g, m, &u);
+    return ok;
 }
 
-static bool king_move_ok(struct game_state* g, index_t from, index_t to)
+/* Pawn moves from `from` to the tiles in `mask`, which holds the tiles that
+   answer a check and stay on a pin line. En passant is checked on its own. */
+static void generate_pawn_moves(struct game_state* g, index_t from, struct move_list* list,
+                                enum move_kind kind, bitmap_t mask)
 {
-    if (g->player == WHITE && from == E1) {
-        if (to == G1) {
-            return castle_kingside_ok(g);
-        } else if (to == C1) {
-            return castle_queenside_ok(g);
+    const enum color player = g->player;
+    const index_t forward = from + RANK*player;
+    const index_t starting_rank = player == WHITE ? RANK_2 : RANK_7;
+    const index_t en_passant_rank = player == WHITE ? RANK_5 : RANK_4;
+
+    const bool    promoting = rank(forward) == RANK_1 || rank(forward) == RANK_8;
+
+    bitmap_t targets = 0;
+
+    if (g->board[forward] == EMPTY && (kind == MOVES_ALL || promoting)) {
+        targets |= bit(forward);
+        if (rank(from) == starting_rank && g->board[forward + RANK*player] == EMPTY)
+            targets |= bit(forward + RANK*player);
+    }
+
+    bitmap_t attacks = pawn_threatmap(g, from);
+    while (attacks) {
+        const index_t to = pop_lsb(&attacks);
+        if (enemies(g->board[to], player)) {
+            targets |= bit(to);
+        } else if (file(to) == g->last_pawn_double_move_file && rank(from) == en_passant_rank
+                && g->board[to] == EMPTY && en_passant_ok(g, move_make(from, to, EMPTY))) {
+            move_list_push(list, from, to, EMPTY);
         }
-    } else if (g->player == BLACK && from == E8) {
-        if (to == G8) {
-            return castle_kingside_ok(g);
-        } else if (to == C8) {
-            return castle_queenside_ok(g);
+    }
+
+    targets &= mask;
+    while (targets) {
+        const index_t to = pop_lsb(&targets);
+        if (promoting) {
+            move_list_push(list, from, to, QUEEN);
+            if (kind == MOVES_CAPTURES && g->board[to] == EMPTY)
+                continue;
+            move_list_push(list, from, to, ROOK);
+            move_list_push(list, from, to, BISHOP);
+            move_list_push(list, from, to, KNIGHT);
+        } else {
+            move_list_push(list, from, to, EMPTY);
         }
     }
-    return bit(to) & king_threatmap(from)
-        && bit(to) & ~threatmap(g, -piece_color(g->board[from]));
 }
 
-static bool move_ok(struct game_state* g, index_t from, index_t to)
+/* Writes every legal move of `kind` for the player to move. The checkers and
+   pinned pieces are found once, so the moves are legal as generated: in
+   check only moves that take the checker or block its line count, a pinned
+   piece stays on its pin line and the king only steps to tiles that aren't
+   attacked once it has left its own. */
+static void generate_moves(struct game_state* g, struct move_list* list, enum move_kind kind)
 {
-    //printf("checking move for %s\n", player_str[g->player]);
-    /* Player must own piece it moves
-       and a player can't capture their own pieces. */
-    if (g->board[from] == EMPTY || enemies(g->player, g->board[from]) || friends(g->player, g->board[to])) {
-        //printf("must own piece it moves and can't attack its own pieces\n");
-        return false;
+    const enum color player   = g->player;
+    const bitmap_t   own      = g->colors[attr_index(player)];
+    const bitmap_t   enemy    = g->colors[attr_index(-player)];
+    const bitmap_t   occupied = occupancy(g);
+    const bitmap_t   allowed  = kind == MOVES_CAPTURES ? enemy : ~own;
+    const index_t    king     = g->attr[attr_index(player)] & KING_POSITION;
+    const bitmap_t   checkers = attackers(g, king, occupied, -player);
+
+    list->n = 0;
+
+    bitmap_t targets = king_threatmap(king) & allowed;
+    while (targets) {
+        const index_t to = pop_lsb(&targets);
+        if (!attackers(g, to, occupied & ~bit(king), -player))
+            move_list_push(list, king, to, EMPTY);
     }
-
-    typeof(*g) restore = *g;
-    move(g, from, to);
-    bool check = is_check(g, -g->player);
-    *g = restore;
-    if (check) {
-        //printf("move causes check!\n");
-        return false;
+    if (checkers & (checkers - 1))
+        return; /* only the king can get out of a double check */
+
+    if (kind == MOVES_ALL && !checkers && king == (player == WHITE ? E1 : E8)) {
+        if (castle_kingside_ok(g))
+            move_list_push(list, king, king + 2, EMPTY);
+        if (castle_queenside_ok(g))
+            move_list_push(list, king, king - 2, EMPTY);
     }
 
-    switch (piece_abs(g->board[from])) {
-    case EMPTY:
-        //printf("can't move empty tile\n");
-        return false;
-    case PAWN:
-        //printf("checking pawn move...\n");
-        return pawn_move_ok(g, from, to);
-    case KING:
-        //printf("checking king move...\n");
-        return king_move_ok(g, from, to);
-    default:
-        //printf("checking other move...\n");
-        return bit(to) & piece_threatmap(g, from);
+    const bitmap_t evasions = checkers ? between_table[king][__builtin_ctzll(checkers)] | checkers : ~(bitmap_t)0;
+
+    bitmap_t pinned  = 0;
+    bitmap_t snipers = ((rook_threatmap(0, king) & (g->pieces[ROOK] | g->pieces[QUEEN]))
+                      | (bishop_threatmap(0, king) & (g->pieces[BISHOP] | g->pieces[QUEEN]))) & enemy;
+    while (snipers) {
+        const bitmap_t blockers = between_table[king][pop_lsb(&snipers)] & occupied;
+        if (blockers && !(blockers & (blockers - 1)))
+            pinned |= blockers & own;
     }
 
-    assert(false);
-}
+    bitmap_t pieces = own & ~bit(king);
+    while (pieces) {
+        const index_t  from = pop_lsb(&pieces);
+        const bitmap_t mask = evasions & (pinned & bit(from) ? line_table[king][from] : ~(bitmap_t)0);
 
-static bitmap_t valid_moves(struct game_state* g, index_t i)
-{
-    bitmap_t output = 0;
-    for (index_t j=0; j<BOARD_SIZE; j++) {
-        if (move_ok(g, i, j)) {
-            output |= bit(j);
+        if (piece_abs(g->board[from]) == PAWN) {
+            generate_pawn_moves(g, from, list, kind, mask);
+            continue;
         }
+
+        targets = piece_threatmap(g, from, occupied) & allowed & mask;
+        while (targets)
+            move_list_push(list, from, pop_lsb(&targets), EMPTY);
     }
-    return output;
 }
 
-static inline bool draw(struct game_state* g)
+/* Writes every move the player to move can legally make */
+static void legal_moves(struct game_state* g, struct move_list* list)
 {
-    // TODO: implement stalemate
-    return g->turns_without_captures >= 50;
+    generate_moves(g, list, MOVES_ALL);
 }
 
-// TODO: fix this garbage
-static bool checkmate(struct game_state* g)
+/* Writes every legal capture and queen promotion */
+static void legal_captures(struct game_state* g, struct move_list* list)
 {
-    if (!is_check(g, g->player))
-        return false;
+    generate_moves(g, list, MOVES_CAPTURES);
+}
 
-    // TODO: avoid doubly nested for loop
-    for (int i=0; i<BOARD_SIZE; i++) {
-        for (int j=0; j<BOARD_SIZE; j++) {
-            if (move_ok(g, i, j)) {
+static bool move_ok(struct game_state* g, move_t m)
+{
+    struct move_list moves;
+    legal_moves(g, &moves);
+    for (size_t i = 0; i < moves.n; i++) {
+        if (moves.moves[i] == m)
+            return true;
+    }
+    return false;
+}
+
+static bitmap_t valid_moves(struct game_state* g, index_t i)
+{
+    struct move_list moves;
+    legal_moves(g, &moves);
+
+    bitmap_t output = 0;
+    for (size_t j = 0; j < moves.n; j++) {
+        if (move_from(moves.moves[j]) == i) {
+            output |= bit(move_to(moves.moves[j]));
+        }
+    }
+    return output;
+}
+
+static bool checkmate(struct game_state* g)
+{
+    if (!is_check(g, g->player))
+        return false;
+
+    struct move_list moves;
+    legal_moves(g, &moves);
+    return moves.n == 0;
+}
+
+/* plies without a capture or pawn move after which the game is drawn */
+#define FIFTY_MOVE_PLIES 100
+
+enum game_status {
+    GAME_ONGOING,
+    GAME_CHECKMATE,
+    GAME_STALEMATE,
+    GAME_FIFTY_MOVES,
+    GAME_REPETITION,
+    GAME_INSUFFICIENT_MATERIAL,
+};
+
+static const char* const game_status_str[] = {
+    [GAME_ONGOING]               = "ongoing",
+    [GAME_CHECKMATE]             = "checkmate",
+    [GAME_STALEMATE]             = "stalemate",
+    [GAME_FIFTY_MOVES]           = "the fifty-move rule",
+    [GAME_REPETITION]            = "threefold repetition",
+    [GAME_INSUFFICIENT_MATERIAL] = "insufficient material",
+};
+
+/* Neither side can ever mate: only kings, a single minor piece, or bishops
+   that all stand on tiles of one color. */
+static bool insufficient_material(const struct game_state* g)
+{
+    if (g->pieces[PAWN] | g->pieces[ROOK] | g->pieces[QUEEN])
+        return false;
+    if (__builtin_popcountll(g->pieces[KNIGHT] | g->pieces[BISHOP]) <= 1)
+        return true;
+    if (g->pieces[KNIGHT])
+        return false;
+    return !(g->pieces[BISHOP] & LIGHT_BITMAP) || !(g->pieces[BISHOP] & ~LIGHT_BITMAP);
+}
+
+/* Whether the player to move has a legal move. Usually the king has a safe
+   step, and the other moves need not be generated at all. */
+static bool has_legal_move(struct game_state* g)
+{
+    const index_t  king     = g->attr[attr_index(g->player)] & KING_POSITION;
+    const bitmap_t occupied = occupancy(g) & ~bit(king);
+
+    bitmap_t steps = king_threatmap(king) & ~g->colors[attr_index(g->player)];
+    while (steps) {
+        if (!attackers(g, pop_lsb(&steps), occupied, -g->player))
+            return true;
+    }
+
+    struct move_list moves;
+    legal_moves(g, &moves);
+    return moves.n != 0;
+}
+
+/* Whether the game is over in this position and why. The legal moves are
+   written to `moves` for the caller to go on with; without a list the
+   search for them stops at the first one. Whether the position repeated is
+   up to the caller, as the game and the search count that differently.
+   Mate and stalemate take precedence over the draw rules. */
+static enum game_status game_status(struct game_state* g, struct move_list* moves, bool repeated)
+{
+    bool any;
+    if (moves) {
+        legal_moves(g, moves);
+        any = moves->n != 0;
+    } else {
+        any = has_legal_move(g);
+    }
+    if (!any)
+        return is_check(g, g->player) ? GAME_CHECKMATE : GAME_STALEMATE;
+    if (g->turns_without_captures >= FIFTY_MOVE_PLIES)
+        return GAME_FIFTY_MOVES;
+    if (repeated)
+        return GAME_REPETITION;
+    if (insufficient_material(g))
+        return GAME_INSUFFICIENT_MATERIAL;
+    return GAME_ONGOING;
+}
+
+/* Bitbases for king and queen, king and rook, and king and pawn against a
+   lone king. Each holds one bit per position, set if the side with the piece
+   wins. Positions are indexed with that side as white: the side to move,
+   then the white king, black king and piece tiles. init_bitbases() builds
+   each table at startup, so no search pays for it, by retrograde iteration:
+   the positions won for white grow until no more are found, and whatever is
+   left is a draw. */
+#define BITBASE_SIZE (2 * BOARD_SIZE * BOARD_SIZE * BOARD_SIZE)
+#define BITBASE_WIN  10000 /* above any material score, below the mate scores */
+
+enum bitbase_result {
+    BB_UNKNOWN = 0,
+    BB_DRAW,
+    BB_WIN,
+    BB_INVALID,
+};
+
+static struct bitbase {
+    enum chess_piece piece;
+    uint8_t          win[BITBASE_SIZE / 8];
+} bitbases[] = {
+    { .piece = QUEEN },
+    { .piece = ROOK },
+    { .piece = PAWN }, /* last, its promotions look up the other two */
+};
+
+static inline size_t bitbase_index(int weak_to_move, index_t king, index_t weak_king, index_t piece)
+{
+    return ((size_t)weak_to_move * BOARD_SIZE + king) * BOARD_SIZE * BOARD_SIZE + weak_king * BOARD_SIZE + piece;
+}
+
+static struct bitbase* bitbase_for(enum chess_piece piece);
+
+static inline bool bitbase_win(struct bitbase* bb, size_t i)
+{
+    return bb->win[i / 8] & (1 << (i % 8));
+}
+
+/* tiles the white piece attacks with both kings on the board */
+static bitmap_t bitbase_attacks(enum chess_piece piece, index_t i, bitmap_t occupied)
+{
+    switch (piece) {
+    case QUEEN: return queen_threatmap(occupied, i);
+    case ROOK:  return rook_threatmap(occupied, i);
+    default:    return pawn_attacks(bit(i), WHITE);
+    }
+}
+
+/* what white gets from the pawn move to `to`, which promotes if it's on the last rank */
+static enum bitbase_result bitbase_pawn_move(uint8_t* r, index_t k, index_t wk, index_t to)
+{
+    if (rank(to) != RANK_8)
+        return r[bitbase_index(1, k, wk, to)];
+
+    const size_t i = bitbase_index(1, k, wk, to);
+    return bitbase_win(bitbase_for(QUEEN), i) || bitbase_win(bitbase_for(ROOK), i) ? BB_WIN : BB_DRAW;
+}
+
+static void bitbase_build(struct bitbase* bb)
+{
+    const enum chess_piece piece = bb->piece;
+
+    uint8_t* r = calloc(BITBASE_SIZE, 1);
+    if (r == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    /* illegal positions, and mates and stalemates with black to move */
+    for (size_t i = 0; i < BITBASE_SIZE; i++) {
+        const index_t  p = i % BOARD_SIZE, wk = i / BOARD_SIZE % BOARD_SIZE, k = i / (BOARD_SIZE * BOARD_SIZE) % BOARD_SIZE;
+        const int      weak_to_move = i / (BOARD_SIZE * BOARD_SIZE * BOARD_SIZE);
+        const bitmap_t occupied     = bit(k) | bit(wk) | bit(p);
+
+        if (k == wk || p == k || p == wk || (king_threatmap(k) & bit(wk))
+         || (piece == PAWN && (rank(p) == RANK_1 || rank(p) == RANK_8))) {
+            r[i] = BB_INVALID;
+            continue;
+        }
+
+        const bitmap_t attacked = bitbase_attacks(piece, p, occupied);
+        if (!weak_to_move) {
+            if (attacked & bit(wk))
+                r[i] = BB_INVALID;
+            continue;
+        }
+
+        /* black's king only escapes to tiles nothing guards, taking the piece
+           if it's loose; a slider sees through the tile the king leaves */
+        const bitmap_t guarded = king_threatmap(k) | bitbase_attacks(piece, p, occupied & ~bit(wk));
+        const bitmap_t escapes = king_threatmap(wk) & ~guarded;
+        if (escapes & bit(p))
+            r[i] = BB_DRAW;
+        else if (!escapes)
+            r[i] = attacked & bit(wk) ? BB_WIN : BB_DRAW;
+    }
+
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = 0; i < BITBASE_SIZE; i++) {
+            if (r[i] != BB_UNKNOWN)
+                continue;
+
+            const index_t  p = i % BOARD_SIZE, wk = i / BOARD_SIZE % BOARD_SIZE, k = i / (BOARD_SIZE * BOARD_SIZE) % BOARD_SIZE;
+            const int      weak_to_move = i / (BOARD_SIZE * BOARD_SIZE * BOARD_SIZE);
+            const bitmap_t occupied     = bit(k) | bit(wk) | bit(p);
+            bool           win;
+
+            if (weak_to_move) {
+                /* won if every black king move leads to a won position */
+                const bitmap_t guarded = king_threatmap(k) | bitbase_attacks(piece, p, occupied & ~bit(wk));
+                bitmap_t       escapes = king_threatmap(wk) & ~guarded;
+                win = true;
+                while (escapes && win)
+                    win = r[bitbase_index(0, k, pop_lsb(&escapes), p)] == BB_WIN;
+            } else {
+                /* won if any white move leads to a won position */
+                bitmap_t kings = king_threatmap(k) & ~king_threatmap(wk) & ~bit(p);
+                win = false;
+                while (kings && !win)
+                    win = r[bitbase_index(1, pop_lsb(&kings), wk, p)] == BB_WIN;
+
+                if (piece == PAWN) {
+                    const index_t one = p + RANK;
+                    if (!win && !(occupied & bit(one))) {
+                        win = bitbase_pawn_move(r, k, wk, one) == BB_WIN;
+                        if (!win && rank(p) == RANK_2 && !(occupied & bit(one + RANK)))
+                            win = r[bitbase_index(1, k, wk, one + RANK)] == BB_WIN;
+                    }
+                } else {
+                    bitmap_t to = bitbase_attacks(piece, p, occupied) & ~occupied;
+                    while (to && !win)
+                        win = r[bitbase_index(1, k, wk, pop_lsb(&to))] == BB_WIN;
+                }
+            }
+
+            if (win) {
+                r[i]    = BB_WIN;
+                changed = true;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < BITBASE_SIZE; i++) {
+        if (r[i] == BB_WIN)
+            bb->win[i / 8] |= 1 << (i % 8);
+    }
+    free(r);
+}
+
+static void init_bitbases(void)
+{
+    for (size_t i = 0; i < sizeof bitbases / sizeof *bitbases; i++)
+        bitbase_build(&bitbases[i]);
+}
+
+/* the table for king and `piece` against king */
+static struct bitbase* bitbase_for(enum chess_piece piece)
+{
+    switch (piece) {
+    case QUEEN: return &bitbases[0];
+    case ROOK:  return &bitbases[1];
+    case PAWN:  return &bitbases[2];
+    default:    return NULL;
+    }
+}
+
+/* Looks up positions with a king and a queen, rook or pawn against a lone
+   king. A draw scores 0; a win scores BITBASE_WIN plus a little for driving
+   the lone king to the edge, bringing the kings together and pushing the
+   pawn, so the search makes progress towards the mate. Returns false if the
+   position isn't in a bitbase. */
+static bool bitbase_probe(struct game_state* g, int* score)
+{
+    const bitmap_t occupied = g->colors[ATTR_WHITE] | g->colors[ATTR_BLACK];
+    if (__builtin_popcountll(occupied) != 3)
+        return false;
+
+    index_t p = __builtin_ctzll(occupied & ~g->pieces[KING]);
+    const enum chess_piece piece = piece_abs(g->board[p]);
+    struct bitbase*        bb    = bitbase_for(piece);
+    if (bb == NULL)
+        return false;
+
+    const enum color strong = piece_color(g->board[p]);
+    index_t k  = g->attr[attr_index(strong)] & KING_POSITION;
+    index_t wk = g->attr[attr_index(-strong)] & KING_POSITION;
+    if (strong == BLACK) {
+        k ^= 56;
+        wk ^= 56;
+        p ^= 56;
+    }
+
+    if (!bitbase_win(bb, bitbase_index(g->player != strong, k, wk, p))) {
+        *score = 0;
+        return true;
+    }
+
+    const int edge   = abs(2 * (int)file(wk) - 7) + abs(2 * (int)(wk / 8) - 7);
+    const int kings  = abs((int)file(k) - (int)file(wk)) + abs((int)(k / 8) - (int)(wk / 8));
+    const int pushed = piece == PAWN ? (int)(p / 8) : 0;
+    const int x      = BITBASE_WIN + 10 * edge - 10 * kings + 50 * pushed;
+    *score = g->player == strong ? x : -x;
+    return true;
+}
+
+/* static evaluation in centipawns for the player to move */
+static inline int evaluate(struct game_state* g)
+{
+    int score;
+    if (bitbase_probe(g, &score))
+        return score;
+    return g->score * g->player;
+}
+
+/* Writes legal move `m` to `buf` in standard algebraic notation, like
+   "Nbd7", "exd8=Q+" or "O-O" */
+#define SAN_MAX 12
+static const char* move_san(struct game_state* g, move_t m, char buf[SAN_MAX])
+{
+    static const char pieces[] = " KQRBNP";
+
+    const index_t from  = move_from(m);
+    const index_t to    = move_to(m);
+    const int     piece = piece_abs(g->board[from]);
+    char*         c     = buf;
+
+    if (piece == KING && to - from == 2) {
+        c += sprintf(c, "O-O");
+    } else if (piece == KING && from - to == 2) {
+        c += sprintf(c, "O-O-O");
+    } else {
+        const bool capture = g->board[to] != EMPTY || (piece == PAWN && file(from) != file(to));
+
+        if (piece == PAWN) {
+            if (capture)
+                *c++ = 'a' + file(from);
+        } else {
+            *c++ = pieces[piece];
+
+            /* name the file, the rank or both if another piece of the same
+               kind can go to the same tile */
+            struct move_list moves;
+            bool ambiguous = false, same_file = false, same_rank = false;
+            legal_moves(g, &moves);
+            for (size_t i = 0; i < moves.n; i++) {
+                const index_t other = move_from(moves.moves[i]);
+                if (move_to(moves.moves[i]) != to || other == from || g->board[other] != g->board[from])
+                    continue;
+                ambiguous = true;
+                same_file |= file(other) == file(from);
+                same_rank |= rank(other) == rank(from);
+            }
+            if (ambiguous && (!same_file || same_rank))
+                *c++ = 'a' + file(from);
+            if (ambiguous && same_file)
+                *c++ = '1' + from / 8;
+        }
+
+        if (capture)
+            *c++ = 'x';
+        *c++ = 'a' + file(to);
+        *c++ = '1' + to / 8;
+
+        if (piece == PAWN && (rank(to) == RANK_1 || rank(to) == RANK_8)) {
+            *c++ = '=';
+            *c++ = pieces[move_promotion(m) == EMPTY ? QUEEN : move_promotion(m)];
+        }
+    }
+
+    struct game_state after = *g;
+    move(&after, m);
+    if (is_check(&after, after.player))
+        *c++ = checkmate(&after) ? '#' : '+';
+    *c = '\0';
+    return buf;
+}
+
+/* Finds the legal move written as `text`, either in standard algebraic or
+   in coordinate notation. Check marks, annotations, a missing '=' before the
+   promotion piece and zeros for castling are accepted. Returns MOVE_NONE if
+   no legal move matches. */
+static move_t move_parse(struct game_state* g, const char* text)
+{
+    char want[SAN_MAX] = "";
+    size_t n = 0;
+    for (; *text && n + 1 < sizeof want; text++) {
+        if (strchr("+#!?=", *text))
+            continue;
+        want[n++] = *text == '0' ? 'O' : *text;
+    }
+    want[n] = '\0';
+
+    struct move_list moves;
+    legal_moves(g, &moves);
+    for (size_t i = 0; i < moves.n; i++) {
+        char san[SAN_MAX], coord[6], have[SAN_MAX];
+        size_t k = 0;
+
+        if (strcmp(want, move_str(moves.moves[i], coord)) == 0)
+            return moves.moves[i];
+
+        move_san(g, moves.moves[i], san);
+        for (const char* c = san; *c; c++) {
+            if (!strchr("+#=", *c))
+                have[k++] = *c;
+        }
+        have[k] = '\0';
+
+        if (strcmp(want, have) == 0)
+            return moves.moves[i];
+    }
+    return MOVE_NONE;
+}
+
+/* builds the lookup tables the move generator depends on, must run before
+   any position is searched */
+static void init_tables(void)
+{
+    init_magics(bishop_magics, bishop_attack_table, bishop_directions);
+    init_magics(rook_magics, rook_attack_table, rook_directions);
+    init_king_attacks();
+    init_lines();
+    init_zobrist();
+    init_piece_square();
+    init_bitbases();
+}
+
+/* recomputes the parts of the game state that are derived from the board */
+static void game_refresh(struct game_state* g)
+{
+    memset(g->pieces, 0, sizeof g->pieces);
+    memset(g->colors, 0, sizeof g->colors);
+
+    for (index_t i = 0; i < BOARD_SIZE; i++) {
+        if (g->board[i] == EMPTY)
+            continue;
+        g->pieces[piece_abs(g->board[i])]               |= bit(i);
+        g->colors[attr_index(piece_color(g->board[i]))] |= bit(i);
+    }
+
+    g->hash          = zobrist_hash(g);
+    g->score         = material_score(g);
+    g->attacks_valid = 0;
+}
+
+/* Sets up the position described by a FEN record. The move counters may be
+   left out. Returns false, leaving `g` undefined, if the record is malformed. */
+static bool game_from_fen(struct game_state* g, const char* fen)
+{
+    static const char pieces[] = " kqrbnp";
+
+    memset(g, 0, sizeof *g);
+    g->last_pawn_double_move_file = -1;
+
+    bool kings[2] = { false, false };
+    index_t r = RANK_8, f = FILE_A;
+    for (; *fen && *fen != ' '; fen++) {
+        if (*fen == '/') {
+            if (f != 8 || r == RANK_1)
+                return false;
+            r -= RANK;
+            f = FILE_A;
+        } else if (*fen >= '1' && *fen <= '8') {
+            f += *fen - '0';
+        } else {
+            const char* p = strchr(pieces, tolower(*fen));
+            if (p == NULL || *p == ' ' || f >= 8)
                 return false;
+            const enum color color = isupper(*fen) ? WHITE : BLACK;
+            g->board[r + f] = color * (piece_t)(p - pieces);
+            if (p - pieces == KING) {
+                if (kings[attr_index(color)])
+                    return false;
+                kings[attr_index(color)] = true;
+                g->attr[attr_index(color)] |= r + f;
+            }
+            f++;
+        }
+        if (f > 8)
+            return false;
+    }
+    if (r != RANK_1 || f != 8 || !kings[ATTR_WHITE] || !kings[ATTR_BLACK])
+        return false;
+
+    char player = 0, castling[5] = "", en_passant[3] = "";
+    int  halfmoves = 0, fullmoves = 1;
+    if (sscanf(fen, " %c %4s %2s %d %d", &player, castling, en_passant, &halfmoves, &fullmoves) < 3)
+        return false;
+
+    if (player != 'w' && player != 'b')
+        return false;
+    g->player = player == 'w' ? WHITE : BLACK;
+
+    g->attr[ATTR_WHITE] |= A_ROOK_TOUCHED | H_ROOK_TOUCHED;
+    g->attr[ATTR_BLACK] |= A_ROOK_TOUCHED | H_ROOK_TOUCHED;
+    for (const char* c = castling; *c && *c != '-'; c++) {
+        switch (*c) {
+        case 'K': g->attr[ATTR_WHITE] &= ~H_ROOK_TOUCHED; break;
+        case 'Q': g->attr[ATTR_WHITE] &= ~A_ROOK_TOUCHED; break;
+        case 'k': g->attr[ATTR_BLACK] &= ~H_ROOK_TOUCHED; break;
+        case 'q': g->attr[ATTR_BLACK] &= ~A_ROOK_TOUCHED; break;
+        default: return false;
+        }
+    }
+    /* a right only counts with the king and that rook still at home,
+       otherwise castling would conjure up a rook */
+    for (int p = ATTR_WHITE; p <= ATTR_BLACK; p++) {
+        const enum color color = p == ATTR_WHITE ? WHITE : BLACK;
+        const index_t    home  = p == ATTR_WHITE ? RANK_1 : RANK_8;
+        if (g->board[home + FILE_E] != color * KING)
+            g->attr[p] |= A_ROOK_TOUCHED | H_ROOK_TOUCHED;
+        if (g->board[home + FILE_A] != color * ROOK)
+            g->attr[p] |= A_ROOK_TOUCHED;
+        if (g->board[home + FILE_H] != color * ROOK)
+            g->attr[p] |= H_ROOK_TOUCHED;
+    }
+
+    if (en_passant[0] != '-') {
+        if (en_passant[0] < 'a' || en_passant[0] > 'h')
+            return false;
+        /* only kept if a pawn really just moved two tiles past it, as
+           capturing en passant removes that pawn */
+        const index_t tile   = (g->player == WHITE ? RANK_6 : RANK_3) + (en_passant[0] - 'a');
+        const char    rank   = g->player == WHITE ? '6' : '3';
+        const index_t behind = tile - g->player * RANK;
+        if (en_passant[1] == rank && g->board[tile] == EMPTY
+         && g->board[tile + g->player * RANK] == EMPTY && g->board[behind] == -g->player * PAWN)
+            g->last_pawn_double_move_file = en_passant[0] - 'a';
+    }
+
+    g->turns_without_captures = halfmoves;
+    g->turns                  = 2 * (fullmoves > 1 ? fullmoves - 1 : 0) + (g->player == BLACK);
+
+    game_refresh(g);
+    return true;
+}
+
+/* Writes the FEN record of the position to `buf`, which must hold at least
+   FEN_MAX characters */
+#define FEN_MAX 96
+static const char* game_to_fen(struct game_state* g, char buf[FEN_MAX])
+{
+    static const char pieces[] = " kqrbnp";
+    char* c = buf;
+
+    for (index_t r = RANK_8; r >= RANK_1; r -= RANK) {
+        int empty = 0;
+        for (index_t f = FILE_A; f <= FILE_H; f++) {
+            const piece_t p = g->board[r + f];
+            if (p == EMPTY) {
+                empty++;
+                continue;
             }
+            if (empty)
+                *c++ = '0' + empty;
+            empty = 0;
+            *c++ = p > 0 ? toupper(pieces[p]) : pieces[-p];
+        }
+        if (empty)
+            *c++ = '0' + empty;
+        if (r != RANK_1)
+            *c++ = '/';
+    }
+
+    *c++ = ' ';
+    *c++ = g->player == WHITE ? 'w' : 'b';
+    *c++ = ' ';
+
+    const unsigned rights = castling_rights(g);
+    if (rights & CASTLE_KINGSIDE)
+        *c++ = 'K';
+    if (rights & CASTLE_QUEENSIDE)
+        *c++ = 'Q';
+    if (rights & CASTLE_KINGSIDE << 2)
+        *c++ = 'k';
+    if (rights & CASTLE_QUEENSIDE << 2)
+        *c++ = 'q';
+    if (!rights)
+        *c++ = '-';
+    *c++ = ' ';
+
+    if (g->last_pawn_double_move_file >= 0) {
+        *c++ = 'a' + g->last_pawn_double_move_file;
+        *c++ = g->player == WHITE ? '6' : '3';
+    } else {
+        *c++ = '-';
+    }
+
+    snprintf(c, FEN_MAX - (c - buf), " %d %d", g->turns_without_captures, g->turns / 2 + 1);
+    return buf;
+}
+
+/* Packs the position into the 32 byte format of board.h, for storing many
+   of them. The move counters are left behind. */
+static void game_pack(struct game_state* g, struct board* b)
+{
+    const unsigned rights = castling_rights(g);
+    const unsigned empty  = g->player == BLACK ? B_EMPTY : W_EMPTY;
+
+    for (index_t i = 0; i < BOARD_SIZE; i++) {
+        const piece_t p = g->board[i];
+        set_piece_at(b, i, p == EMPTY ? empty : (unsigned)piece_abs(p) | (p < 0 ? PACKED_BLACK : 0));
+    }
+
+    /* the corner rooks that may castle, marked with a pawn code */
+    static const struct { index_t tile; piece_t rook; unsigned right; } corners[] = {
+        { H1,  ROOK, CASTLE_KINGSIDE       }, { A1,  ROOK, CASTLE_QUEENSIDE      },
+        { H8, -ROOK, CASTLE_KINGSIDE << 2  }, { A8, -ROOK, CASTLE_QUEENSIDE << 2 },
+    };
+    for (size_t i = 0; i < sizeof corners / sizeof *corners; i++) {
+        if ((rights & corners[i].right) && g->board[corners[i].tile] == corners[i].rook)
+            set_piece_at(b, corners[i].tile, corners[i].rook > 0 ? W_PAWN : B_PAWN);
+    }
+
+    /* the pawn that just moved two tiles belongs to the player not to move */
+    if (g->last_pawn_double_move_file != -1) {
+        const index_t to = (g->player == BLACK ? RANK_4 : RANK_5) + g->last_pawn_double_move_file;
+        if (g->board[to] == -g->player * PAWN)
+            set_piece_at(b, to, g->player == BLACK ? W_PAWN_ENPASSENTABLE : B_PAWN_ENPASSENTABLE);
+    }
+}
+
+/* Sets up the position packed by game_pack(), with both move counters at 0 */
+static void game_unpack(const struct board* b, struct game_state* g)
+{
+    memset(g, 0, sizeof *g);
+    g->last_pawn_double_move_file = -1;
+    g->player                     = WHITE;
+    g->attr[ATTR_WHITE]           = A_ROOK_TOUCHED | H_ROOK_TOUCHED;
+    g->attr[ATTR_BLACK]           = A_ROOK_TOUCHED | H_ROOK_TOUCHED;
+
+    for (index_t i = 0; i < BOARD_SIZE; i++) {
+        const unsigned       code  = piece_at(b, i);
+        const enum color     color = is_black(code) ? BLACK : WHITE;
+        enum chess_piece     piece = code & PACKED_PIECE;
+
+        if (piece == EMPTY) {
+            g->player = color;
+            continue;
+        }
+        if (piece == PAWN + 1) {
+            piece = PAWN;
+            g->last_pawn_double_move_file = file(i);
+        } else if (piece == PAWN && (rank(i) == RANK_1 || rank(i) == RANK_8)) {
+            piece = ROOK;
+            g->attr[attr_index(color)] &= file(i) == FILE_H ? ~H_ROOK_TOUCHED : ~A_ROOK_TOUCHED;
+        } else if (piece == KING) {
+            g->attr[attr_index(color)] |= i;
+        }
+        g->board[i] = color * (piece_t)piece;
+    }
+
+    game_refresh(g);
+}
+
+static void dump_game_state(struct game_state* g)
+{
+    char fen[FEN_MAX];
+    printf("\nFEN: %s\n", game_to_fen(g, fen));
+}
+
+#define START_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+
+/* sets up the game to start from `fen`, or the normal starting position if
+   it is NULL */
+static bool game_init(struct game_state* g, const char* fen)
+{
+    if (!game_from_fen(g, fen ? fen : START_FEN))
+        return false;
+    sigint_state_copy = *g;
+    return true;
+}
+
+static index_t input_to_index(char input[2])
+{
+    const int file = toupper(input[0])-'A';
+    const int rank = RANK*(input[1] - '1');
+
+    //printf("evaluated to index %d\n", file + rank);
+
+    if (file < FILE_A || file > FILE_H || rank < RANK_1 || rank > RANK_8)
+        return -1;
+
+    return file + rank;
+}
+
+// TODO: Implement algebaric notation
+static bool player_move(struct game_state* g)
+{
+    char input[3] = { 0 };
+
+    int from = -1, to = -1;
+
+    printf("\nMove piece\nfrom: ");
+    scanf(" %2s", input);
+
+    from = input_to_index(input);
+
+    if (from == -1)
+        return false;
+
+    //print_threatmap(valid_moves(g, from));
+    printf("\nto: ");
+    scanf(" %2s", input);
+
+    to = input_to_index(input);
+
+    if (to == -1)
+        return false;
+
+    enum chess_piece promotion = EMPTY;
+    if (piece_abs(g->board[from]) == PAWN && (rank(to) == RANK_1 || rank(to) == RANK_8)) {
+        printf("\npromote to (q/r/b/n): ");
+        scanf(" %1s", input);
+        switch (tolower(input[0])) {
+        case 'q': promotion = QUEEN;  break;
+        case 'r': promotion = ROOK;   break;
+        case 'b': promotion = BISHOP; break;
+        case 'n': promotion = KNIGHT; break;
+        default:  return false;
         }
     }
 
+    const move_t m = move_make(from, to, promotion);
+
+    if (!move_ok(g, m))
+        return false;
+
+    move(g, m);
+
+    return true;
+}
+
+static void print_debug(struct game_state* g)
+{
+    for (int i=0; i<2; i++) {
+        printf("%s:\n", color_str_capitalized[i]);
+        printf("    A king touched: %s\n",        bool_str[!!(g->attr[i] & KING_TOUCHED)]);
+        printf("    A rook touched: %s\n",        bool_str[!!(g->attr[i] & A_ROOK_TOUCHED)]);
+        printf("    H rook touched: %s\n",        bool_str[!!(g->attr[i] & H_ROOK_TOUCHED)]);
+        printf("    can king side castle: %s\n",  bool_str[castle_kingside_ok(g)]);
+        printf("    can queen side castle: %s\n", bool_str[castle_queenside_ok(g)]);
+        printf("    king pos: %s\n",              tile_str[g->attr[i] & KING_POSITION]);
+        printf("    king pos: %u\n",              g->attr[i] & KING_POSITION);
+        printf("    in check: %s\n",              bool_str[is_check(g, WHITE)]);
+    }
+
+    printf("Estimated score: %.2f\n", g->score / 100.0);
+    printf("Turns with no capture: %d\n", g->turns_without_captures);
+}
+
+
+static  void sigint_handler(int signal)
+{
+    (void)signal;
+    paint_board(&sigint_state_copy, -1, -1);
+    print_debug(&sigint_state_copy);
+    dump_game_state(&sigint_state_copy);
+    exit(0);
+}
+
+/* The transposition table remembers the result of searched positions by
+   their Zobrist hash. Entries are grouped in buckets of one cache line, and
+   when a bucket is full the shallowest entry from the oldest search is
+   replaced. It lives for the whole game so later moves reuse earlier work. */
+enum tt_bound {
+    BOUND_NONE  = 0,
+    BOUND_UPPER = 1, /* true value of the position <= score, stored on a fail-low */
+    BOUND_LOWER = 2, /* true value of the position >= score, stored on a fail-high */
+    BOUND_EXACT = 3,
+};
+
+/* Search threads share the table without locks. The key is stored xor'ed
+   with the data word, so an entry torn by two threads writing at once no
+   longer matches either position and is ignored. */
+struct tt_entry {
+    uint64_t key;
+    union {
+        struct {
+            int16_t score;     /* mate scores relative to this position, see score_to_tt() */
+            move_t  move;
+            uint8_t depth;
+            uint8_t gen_bound; /* search generation in the high 6 bits, bound in the low 2 */
+        };
+        uint64_t data;
+    };
+};
+static_assert(sizeof(struct tt_entry) == 16, "tt_entry should be 16 bytes");
+
+#define TT_BUCKET_ENTRIES 4
+
+struct tt_bucket {
+    struct tt_entry entries[TT_BUCKET_ENTRIES];
+} __attribute__((aligned(64)));
+static_assert(sizeof(struct tt_bucket) == 64, "tt_bucket should fill one cache line");
+
+static struct {
+    struct tt_bucket* buckets;
+    size_t            n;
+    size_t            bytes;
+    uint8_t           generation;
+} tt;
+
+static void tt_free(void)
+{
+    if (tt.buckets)
+        munmap(tt.buckets, tt.bytes);
+    tt.buckets = NULL;
+    tt.n       = 0;
+}
+
+/* allocates `megabytes` of table, backed by huge pages if asked and available */
+static void tt_init(size_t megabytes, bool huge_pages)
+{
+    tt_free();
+
+    tt.n     = megabytes * 1024 * 1024 / sizeof *tt.buckets;
+    tt.n     = tt.n ? tt.n : 1;
+    tt.bytes = tt.n * sizeof *tt.buckets;
+
+    void* mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (huge_pages)
+        mem = mmap(NULL, tt.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (mem == MAP_FAILED) {
+        mem = mmap(NULL, tt.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            perror("mmap");
+            exit(EXIT_FAILURE);
+        }
+#ifdef MADV_HUGEPAGE
+        if (huge_pages)
+            madvise(mem, tt.bytes, MADV_HUGEPAGE);
+#endif
+    }
+
+    tt.buckets    = mem;
+    tt.generation = 0;
+}
+
+static void tt_clear(void)
+{
+    memset(tt.buckets, 0, tt.bytes);
+    tt.generation = 0;
+}
+
+/* called once per computer move so entries from earlier moves age out, and
+   once before searches that run side by side, see search_limits.tt_aged */
+static void tt_new_search(void)
+{
+    tt.generation = (tt.generation + 1) & 0x3F;
+}
+
+static inline struct tt_bucket* tt_bucket(uint64_t key)
+{
+    return &tt.buckets[(size_t)(((unsigned __int128)key * tt.n) >> 64)];
+}
+
+static inline enum tt_bound tt_entry_bound(const struct tt_entry* e)
+{
+    return e->gen_bound & 0x3;
+}
+
+static inline unsigned tt_entry_age(const struct tt_entry* e)
+{
+    return (tt.generation - (e->gen_bound >> 2)) & 0x3F;
+}
+
+/* reads an entry as two atomic words, since another thread may be writing it */
+static inline struct tt_entry tt_load(const struct tt_entry* e)
+{
+    struct tt_entry copy;
+    copy.data = __atomic_load_n(&e->data, __ATOMIC_RELAXED);
+    copy.key  = __atomic_load_n(&e->key, __ATOMIC_RELAXED) ^ copy.data;
+    return copy;
+}
+
+/* copies the entry for `key` to `out`, returns false if there is none */
+static bool tt_probe(uint64_t key, struct tt_entry* out)
+{
+    const struct tt_bucket* b = tt_bucket(key);
+    for (int i = 0; i < TT_BUCKET_ENTRIES; i++) {
+        *out = tt_load(&b->entries[i]);
+        if (out->key == key && tt_entry_bound(out) != BOUND_NONE)
+            return true;
+    }
+    return false;
+}
+
+/* Mate scores count plies from the root, but a table entry may be reached
+   at another ply, so they are stored as distance from the entry's position */
+static inline int score_to_tt(int score, int ply)
+{
+    if (score >= MATE_BOUND)
+        return score + ply;
+    if (score <= -MATE_BOUND)
+        return score - ply;
+    return score;
+}
+
+static inline int score_from_tt(int score, int ply)
+{
+    if (score >= MATE_BOUND)
+        return score - ply;
+    if (score <= -MATE_BOUND)
+        return score + ply;
+    return score;
+}
+
+static void tt_store(uint64_t key, int depth, enum tt_bound bound, int score, move_t m)
+{
+    struct tt_bucket* b       = tt_bucket(key);
+    struct tt_entry*  replace = &b->entries[0];
+    struct tt_entry   old     = tt_load(replace);
+
+    for (int i = 0; i < TT_BUCKET_ENTRIES; i++) {
+        const struct tt_entry e = tt_load(&b->entries[i]);
+        if (e.key == key) {
+            /* keep the old best move rather than forget it */
+            if (m == MOVE_NONE)
+                m = e.move;
+            replace = &b->entries[i];
+            break;
+        }
+        if (e.depth - 8*(int)tt_entry_age(&e) < old.depth - 8*(int)tt_entry_age(&old)) {
+            replace = &b->entries[i];
+            old     = e;
+        }
+    }
+
+    struct tt_entry e = {
+        .score     = (int16_t)score,
+        .move      = m,
+        .depth     = (uint8_t)depth,
+        .gen_bound = (uint8_t)(tt.generation << 2 | bound),
+    };
+    __atomic_store_n(&replace->data, e.data, __ATOMIC_RELAXED);
+    __atomic_store_n(&replace->key, key ^ e.data, __ATOMIC_RELAXED);
+}
+
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* What computer_move() may spend on a move, zero means no limit. With no
+   limits at all it searches to MAX_DEPTH. */
+struct search;
+struct search_limits {
+    int      depth;
+    uint64_t nodes;
+    int64_t  movetime;     /* milliseconds for this move */
+    int64_t  time[2];      /* milliseconds left on each player's clock, see attr_index() */
+    int64_t  increment[2]; /* milliseconds added to each player's clock per move */
+
+    /* if set, called by the main search thread after every completed iteration */
+    void   (*report)(struct search* s, void* arg);
+    void*    report_arg;
+
+    /* if set, the search stops soon after another thread sets this */
+    atomic_bool* abort;
+
+    /* play from the opening book when it has the position, see book_move() */
+    bool book;
+
+    /* the caller already aged the hash table with tt_new_search(), as
+       searches running side by side must not each do it */
+    bool tt_aged;
+};
+
+/* threads searching each computer move, see computer_move() */
+static size_t search_threads = 1;
+
+/* One thread's search. All threads searching the same position share the
+   stop flag and the transposition table, everything else is their own. */
+struct search {
+    struct search_limits limits;
+    int64_t  start;
+    int64_t  soft_deadline; /* don't start another iteration after this */
+    int64_t  deadline;      /* abort the current iteration at this point */
+    uint64_t nodes;         /* only written by the owner, read atomically by thread 0 */
+    int      depth;         /* deepest completed iteration */
+    int      score;
+    move_t   best;
+
+    struct game_state g;       /* this thread's copy of the position */
+    uint64_t          path[MAX_PLY + 1]; /* keys of the positions from the root to the current ply */
+    atomic_bool*      stop;
+    struct search*    threads; /* every thread searching the position, [0] is the main one */
+    size_t            thread_count;
+    size_t            id;
+    uint64_t          seed;    /* varies the root move order of helper threads */
+
+    /* move ordering state, see score_moves() */
+    move_t   killers[MAX_PLY][2];
+    int32_t  history[2][BOARD_SIZE][BOARD_SIZE];
+};
+
+/* Moves are searched in the order of these scores: the hash move, then
+   captures and promotions by MVV-LVA (most valuable victim first, least
+   valuable attacker breaking ties), then the killer moves that caused a beta
+   cutoff at the same ply, then quiet moves by how often they did anywhere. */
+enum move_order {
+    ORDER_HASH_MOVE = 1 << 30,
+    ORDER_CAPTURE   = 1 << 28,
+    ORDER_KILLER    = 1 << 27,
+};
+
+static inline bool is_capture(struct game_state* g, move_t m)
+{
+    return g->board[move_to(m)] != EMPTY
+        || (piece_abs(g->board[move_from(m)]) == PAWN && file(move_from(m)) != file(move_to(m)));
+}
+
+static void score_moves(struct search* s, struct game_state* g, struct move_list* moves,
+                        int32_t scores[MAX_MOVES], move_t tt_move, int ply)
+{
+    const int p = attr_index(g->player);
+
+    for (size_t i = 0; i < moves->n; i++) {
+        const move_t  m        = moves->moves[i];
+        const index_t from     = move_from(m);
+        const index_t to       = move_to(m);
+        const piece_t attacker = piece_abs(g->board[from]);
+
+        if (m == tt_move) {
+            scores[i] = ORDER_HASH_MOVE;
+        } else if (is_capture(g, m) || move_promotion(m) == QUEEN) {
+            /* en passant leaves the destination empty, the victim is a pawn */
+            const piece_t victim = g->board[to] == EMPTY ? PAWN : piece_abs(g->board[to]);
+            scores[i] = ORDER_CAPTURE
+                      + (piece_value[victim] + piece_value[move_promotion(m)]) * 16
+                      - piece_value[attacker];
+        } else if (m == s->killers[ply][0]) {
+            scores[i] = ORDER_KILLER + 1;
+        } else if (m == s->killers[ply][1]) {
+            scores[i] = ORDER_KILLER;
+        } else {
+            scores[i] = s->history[p][from][to];
+        }
+    }
+}
+
+/* selection sort one step at a time, since a cutoff usually comes early */
+static move_t pick_move(struct move_list* moves, int32_t scores[MAX_MOVES], size_t i)
+{
+    size_t best = i;
+    for (size_t j = i + 1; j < moves->n; j++) {
+        if (scores[j] > scores[best])
+            best = j;
+    }
+
+    const move_t  m = moves->moves[best];
+    const int32_t x = scores[best];
+    moves->moves[best] = moves->moves[i];
+    scores[best]       = scores[i];
+    moves->moves[i]    = m;
+    scores[i]          = x;
+    return m;
+}
+
+/* rewards a quiet move that caused a beta cutoff */
+static void update_quiet_stats(struct search* s, struct game_state* g, move_t m, int depth, int ply)
+{
+    int32_t* h = &s->history[attr_index(g->player)][move_from(m)][move_to(m)];
+
+    if (s->killers[ply][0] != m) {
+        s->killers[ply][1] = s->killers[ply][0];
+        s->killers[ply][0] = m;
+    }
+
+    *h += depth * depth;
+    if (*h >= ORDER_KILLER) {
+        for (int c = 0; c < 2; c++)
+            for (index_t i = 0; i < BOARD_SIZE; i++)
+                for (index_t j = 0; j < BOARD_SIZE; j++)
+                    s->history[c][i][j] /= 2;
+    }
+}
+
+/* checked every few thousand nodes, aborting the search is not free */
+#define SEARCH_CHECK_INTERVAL 2048
+
+static uint64_t search_total_nodes(struct search* s)
+{
+    uint64_t nodes = 0;
+    for (size_t i = 0; i < s->thread_count; i++)
+        nodes += __atomic_load_n(&s->threads[i].nodes, __ATOMIC_RELAXED);
+    return nodes;
+}
+
+static inline bool search_stopped(struct search* s)
+{
+    return atomic_load_explicit(s->stop, memory_order_relaxed);
+}
+
+/* only the main thread checks the limits, the helpers follow its stop flag */
+static void search_check_limits(struct search* s)
+{
+    if ((s->limits.nodes && search_total_nodes(s) >= s->limits.nodes)
+     || (s->deadline && now_ms() >= s->deadline)
+     || (s->limits.abort && atomic_load_explicit(s->limits.abort, memory_order_relaxed))) {
+        atomic_store_explicit(s->stop, true, memory_order_relaxed);
+    }
+}
+
+/* counts a node, returns true if the search should unwind */
+static inline bool search_node(struct search* s)
+{
+    __atomic_store_n(&s->nodes, s->nodes + 1, __ATOMIC_RELAXED);
+    if (s->id == 0 && s->nodes % SEARCH_CHECK_INTERVAL == 0)
+        search_check_limits(s);
+    return search_stopped(s);
+}
+
+/* a capture that can't bring the score this close to alpha is not searched */
+#define DELTA_MARGIN 200
+
+/* Searches captures until the position is quiet, so the heuristic is never
+   trusted in the middle of an exchange. The side to move may "stand pat" on
+   the static score instead of capturing, except when in check, where every
+   evasion is searched. */
+static int quiescence(struct search* s, struct game_state* g, int alpha, int beta, int ply)
+{
+    if (search_node(s))
+        return 0;
+
+    const int  stand_pat = evaluate(g);
+    const bool in_check  = is_check(g, g->player);
+
+    if (ply >= MAX_PLY - 1)
+        return stand_pat;
+
+    struct move_list moves;
+    int32_t          scores[MAX_MOVES];
+
+    if (in_check) {
+        legal_moves(g, &moves);
+        if (moves.n == 0)
+            return -MATE_SCORE + ply;
+    } else {
+        if (stand_pat >= beta)
+            return stand_pat;
+        if (stand_pat > alpha)
+            alpha = stand_pat;
+        legal_captures(g, &moves);
+    }
+    score_moves(s, g, &moves, scores, MOVE_NONE, ply);
+
+    for (size_t i = 0; i < moves.n; i++) {
+        const move_t mv = pick_move(&moves, scores, i);
+
+        if (!in_check) {
+            const piece_t victim = g->board[move_to(mv)] == EMPTY ? PAWN : piece_abs(g->board[move_to(mv)]);
+            const int     gain   = piece_value[victim] + piece_value[move_promotion(mv)];
+            if (stand_pat + gain + DELTA_MARGIN < alpha)
+                continue;
+        }
+
+        const struct undo u = move(g, mv);
+        const int         x = -quiescence(s, g, -beta, -alpha, ply+1);
+        unmove(g, mv, &u);
+        if (search_stopped(s))
+            return 0;
+        if (x >= beta)
+            return x;
+        if (x > alpha)
+            alpha = x;
+    }
+
+    return alpha;
+}
+
+/* Whether the position at `ply` already occurred on the search path or in
+   the game before the root. Looking back stops at the last capture or pawn
+   move and skips the positions with the other player to move. In the
+   search a single repetition counts as a draw, as the side that could avoid
+   it would have. Without a game history, as in batch and epd mode, only
+   repetitions within the search itself are seen. */
+static bool search_repetition(struct search* s, struct game_state* g, int ply)
+{
+    const struct history* h = g->history;
+
+    s->path[ply] = g->hash;
+    for (int back = 4; back <= g->turns_without_captures; back += 2) {
+        uint64_t key;
+        if (back <= ply)
+            key = s->path[ply - back];
+        else if (h && history_has(h, back - ply))
+            key = history_key(h, back - ply);
+        else
+            break;
+        if (key == g->hash)
+            return true;
+    }
+    return false;
+}
+
+static int alpha_beta(struct search* s, struct game_state* g, int alpha, int beta, int depth, int ply)
+{
+    if (search_node(s))
+        return 0;
+
+    if (search_repetition(s, g, ply))
+        return 0;
+
+    /* at the horizon the moves aren't needed, quiescence() makes its own */
+    if (depth == 0) {
+        switch (game_status(g, NULL, false)) {
+        case GAME_ONGOING:
+            break;
+        case GAME_CHECKMATE:
+            return -MATE_SCORE + ply;
+        default:
+            return 0;
+        }
+        return quiescence(s, g, alpha, beta, ply);
+    }
+
+    /* the draws that need no moves come first, a mate still beats the 50 move rule */
+    if (g->turns_without_captures >= FIFTY_MOVE_PLIES || insufficient_material(g))
+        return game_status(g, NULL, false) == GAME_CHECKMATE ? -MATE_SCORE + ply : 0;
+
+    /* a bitbase draw ends the line; a win is searched on, with evaluate()
+       steering towards the mate, since the bitbases don't know how far it is */
+    int known;
+    if (ply > 0 && bitbase_probe(g, &known) && known == 0)
+        return 0;
+
+    move_t          tt_move = MOVE_NONE;
+    struct tt_entry e;
+    if (tt_probe(g->hash, &e)) {
+        tt_move = e.move;
+        if (e.depth >= depth) {
+            const enum tt_bound bound = tt_entry_bound(&e);
+            const int           score = score_from_tt(e.score, ply);
+            if (bound == BOUND_EXACT
+             || (bound == BOUND_LOWER && score >= beta)
+             || (bound == BOUND_UPPER && score <= alpha)) {
+                return score;
+            }
+        }
+    }
+
+    /* only generated now that the table gave no cutoff */
+    struct move_list moves;
+    legal_moves(g, &moves);
+    if (moves.n == 0)
+        return is_check(g, g->player) ? -MATE_SCORE + ply : 0;
+
+    int    m    = alpha;
+    move_t best = MOVE_NONE;
+
+    int32_t scores[MAX_MOVES];
+    score_moves(s, g, &moves, scores, tt_move, ply);
+
+    for (size_t i = 0; i < moves.n; i++) {
+        const move_t      mv    = pick_move(&moves, scores, i);
+        const bool        quiet = !is_capture(g, mv);
+        const struct undo u     = move(g, mv);
+        int x = -alpha_beta(s, g, -beta, -(alpha > m ? alpha : m), depth-1, ply+1);
+        unmove(g, mv, &u);
+        if (search_stopped(s))
+            return 0;
+        if (x > m) {
+            m    = x;
+            best = mv;
+        }
+        if (m >= beta) {
+            if (quiet)
+                update_quiet_stats(s, g, mv, depth, ply);
+            tt_store(g->hash, depth, BOUND_LOWER, score_to_tt(m, ply), best);
+            return m;
+        }
+    }
+
+    tt_store(g->hash, depth, best == MOVE_NONE ? BOUND_UPPER : BOUND_EXACT, score_to_tt(m, ply), best);
+    return m;
+}
+
+/* Searches every root move to `depth`. Returns false if the search was
+   stopped before all of them were searched. */
+static bool search_root(struct search* s, struct game_state* g, int depth)
+{
+    int    m    = -INFINITE_SCORE;
+    move_t best = MOVE_NONE;
+
+    struct move_list moves;
+    int32_t          scores[MAX_MOVES];
+    const enum game_status status = game_status(g, &moves, false);
+    s->path[0] = g->hash;
+    if (moves.n == 0) {
+        s->best  = MOVE_NONE;
+        s->score = status == GAME_CHECKMATE ? -MATE_SCORE : 0;
+        s->depth = depth;
+        return true;
+    }
+
+    struct tt_entry e;
+    score_moves(s, g, &moves, scores, tt_probe(g->hash, &e) ? e.move : MOVE_NONE, 0);
+
+    /* helper threads shuffle moves of equal rank so they don't all search
+       the same tree in the same order */
+    if (s->id) {
+        for (size_t i = 0; i < moves.n; i++) {
+            if (scores[i] < ORDER_HASH_MOVE)
+                scores[i] += random_u64(&s->seed) & 0xFF;
+        }
+    }
+
+    for (size_t i = 0; i < moves.n; i++) {
+        const move_t      mv = pick_move(&moves, scores, i);
+        const struct undo u  = move(g, mv);
+        search_node(s);
+        if (checkmate(g)) {
+            unmove(g, mv, &u);
+            m    = MATE_SCORE - 1;
+            best = mv;
+            break;
+        }
+        int x = -alpha_beta(s, g, -INFINITE_SCORE, -m, depth-1, 1);
+        unmove(g, mv, &u);
+        if (search_stopped(s))
+            return false;
+
+        if (x > m) {
+            //printf("considering %s to %s with score %d\n", tile_str[move_from(mv)], tile_str[move_to(mv)], x);
+            m    = x;
+            best = mv;
+        }
+    }
+
+    if (best != MOVE_NONE)
+        tt_store(g->hash, depth, BOUND_EXACT, m, best);
+
+    s->best  = best;
+    s->score = m;
+    s->depth = depth;
+    return true;
+}
+
+/* What `limits` allow a search for `player`: the depth, which it returns,
+   and in `soft` and `hard` the milliseconds after its start from which on
+   it starts no new iteration and stops, or 0 for no time limit. On a game
+   clock it plans for about 30 more moves and doesn't start an iteration it
+   likely can't finish. */
+static int search_budget(const struct search_limits* limits, enum color player, int64_t* soft, int64_t* hard)
+{
+    const int p = attr_index(player);
+
+    *soft = 0;
+    *hard = 0;
+    if (limits->movetime) {
+        *hard = limits->movetime;
+        *soft = *hard;
+    } else if (limits->time[p]) {
+        const int64_t left   = limits->time[p];
+        const int64_t budget = left / 30 + limits->increment[p] * 3 / 4;
+        const int64_t most   = left - 50 < 3 * budget ? left - 50 : 3 * budget;
+        *soft = budget / 2;
+        *hard = most > 1 ? most : 1;
+    }
+
+    if (limits->depth)
+        return limits->depth;
+    return limits->movetime || limits->time[p] || limits->nodes ? MAX_PLY : MAX_DEPTH;
+}
+
+/* Turns the limits into deadlines, see search_budget() */
+static void search_start(struct search* s, struct game_state* g, const struct search_limits* limits)
+{
+    s->limits        = *limits;
+    s->start         = now_ms();
+    s->soft_deadline = 0;
+    s->deadline      = 0;
+    s->nodes         = 0;
+    s->depth         = 0;
+    s->score         = 0;
+    s->best          = MOVE_NONE;
+    s->g             = *g;
+    memset(s->killers, 0, sizeof s->killers);
+    memset(s->history, 0, sizeof s->history);
+
+    int64_t soft, hard;
+    s->limits.depth  = search_budget(limits, g->player, &soft, &hard);
+    s->soft_deadline = soft ? s->start + soft : 0;
+    s->deadline      = hard ? s->start + hard : 0;
+}
+
+/* Iterative deepening: searches depth 1, 2, 3... until a limit is hit. Odd
+   helper threads start one ply deeper so the threads spread over depths. */
+static void iterative_deepening(struct search* s)
+{
+    for (int depth = 1 + (s->id & 1); depth <= s->limits.depth; depth++) {
+        if (!search_root(s, &s->g, depth))
+            break;
+        if (s->id == 0 && s->limits.report)
+            s->limits.report(s, s->limits.report_arg);
+        if (s->best == MOVE_NONE || s->score >= MATE_BOUND)
+            break;
+        if (s->id == 0 && s->soft_deadline && now_ms() >= s->soft_deadline)
+            break;
+        if (s->id == 0 && s->limits.nodes && search_total_nodes(s) >= s->limits.nodes)
+            break;
+    }
+}
+
+static void* search_thread(void* arg)
+{
+    iterative_deepening(arg);
+    return NULL;
+}
+
+/* Polyglot opening book. The .bin file is a sorted array of 16 byte big
+   endian entries (key, move, weight, learn) and is mapped read only, so
+   opening it costs nothing and engine processes share the pages. Keys are
+   Polyglot's: an xor over its fixed 781 entry Random64 table below. */
+#define POLYGLOT_RANDOM_COUNT 781
+#define POLYGLOT_CASTLE       768
+#define POLYGLOT_EN_PASSANT   772
+#define POLYGLOT_TURN         780
+
+/* 64 tiles for each of black pawn, white pawn, black knight ... white king,
+   then the four castling rights, the eight en passant files and white to move */
+static const uint64_t polyglot_random[POLYGLOT_RANDOM_COUNT] = {
+    0x9D39247E33776D41ULL, 0x2AF7398005AAA5C7ULL, 0x44DB015024623547ULL, 0x9C15F73E62A76AE2ULL,
+    0x75834465489C0C89ULL, 0x3290AC3A203001BFULL, 0x0FBBAD1F61042279ULL, 0xE83A908FF2FB60CAULL,
+    0x0D7E765D58755C10ULL, 0x1A083822CEAFE02DULL, 0x9605D5F0E25EC3B0ULL, 0xD021FF5CD13A2ED5ULL,
+    0x40BDF15D4A672E32ULL, 0x011355146FD56395ULL, 0x5DB4832046F3D9E5ULL, 0x239F8B2D7FF719CCULL,
+    0x05D1A1AE85B49AA1ULL, 0x679F848F6E8FC971ULL, 0x7449BBFF801FED0BULL, 0x7D11CDB1C3B7ADF0ULL,
+    0x82C7709E781EB7CCULL, 0xF3218F1C9510786CULL, 0x331478F3AF51BBE6ULL, 0x4BB38DE5E7219443ULL,
+    0xAA649C6EBCFD50FCULL, 0x8DBD98A352AFD40BULL, 0x87D2074B81D79217ULL, 0x19F3C751D3E92AE1ULL,
+    0xB4AB30F062B19ABFULL, 0x7B0500AC42047AC4ULL, 0xC9452CA81A09D85DULL, 0x24AA6C514DA27500ULL,
+    0x4C9F34427501B447ULL, 0x14A68FD73C910841ULL, 0xA71B9B83461CBD93ULL, 0x03488B95B0F1850FULL,
+    0x637B2B34FF93C040ULL, 0x09D1BC9A3DD90A94ULL, 0x3575668334A1DD3BULL, 0x735E2B97A4C45A23ULL,
+    0x18727070F1BD400BULL, 0x1FCBACD259BF02E7ULL, 0xD310A7C2CE9B6555ULL, 0xBF983FE0FE5D8244ULL,
+    0x9F74D14F7454A824ULL, 0x51EBDC4AB9BA3035ULL, 0x5C82C505DB9AB0FAULL, 0xFCF7FE8A3430B241ULL,
+    0x3253A729B9BA3DDEULL, 0x8C74C368081B3075ULL, 0xB9BC6C87167C33E7ULL, 0x7EF48F2B83024E20ULL,
+    0x11D505D4C351BD7FULL, 0x6568FCA92C76A243ULL, 0x4DE0B0F40F32A7B8ULL, 0x96D693460CC37E5DULL,
+    0x42E240CB63689F2FULL, 0x6D2BDCDAE2919661ULL, 0x42880B0236E4D951ULL, 0x5F0F4A5898171BB6ULL,
+    0x39F890F579F92F88ULL, 0x93C5B5F47356388BULL, 0x63DC359D8D231B78ULL, 0xEC16CA8AEA98AD76ULL,
+    0x5355F900C2A82DC7ULL, 0x07FB9F855A997142ULL, 0x5093417AA8A7ED5EULL, 0x7BCBC38DA25A7F3CULL,
+    0x19FC8A768CF4B6D4ULL, 0x637A7780DECFC0D9ULL, 0x8249A47AEE0E41F7ULL, 0x79AD695501E7D1E8ULL,
+    0x14ACBAF4777D5776ULL, 0xF145B6BECCDEA195ULL, 0xDABF2AC8201752FCULL, 0x24C3C94DF9C8D3F6ULL,
+    0xBB6E2924F03912EAULL, 0x0CE26C0B95C980D9ULL, 0xA49CD132BFBF7CC4ULL, 0xE99D662AF4243939ULL,
+    0x27E6AD7891165C3FULL, 0x8535F040B9744FF1ULL, 0x54B3F4FA5F40D873ULL, 0x72B12C32127FED2BULL,
+    0xEE954D3C7B411F47ULL, 0x9A85AC909A24EAA1ULL, 0x70AC4CD9F04F21F5ULL, 0xF9B89D3E99A075C2ULL,
+    0x87B3E2B2B5C907B1ULL, 0xA366E5B8C54F48B8ULL, 0xAE4A9346CC3F7CF2ULL, 0x1920C04D47267BBDULL,
+    0x87BF02C6B49E2AE9ULL, 0x092237AC237F3859ULL, 0xFF07F64EF8ED14D0ULL, 0x8DE8DCA9F03CC54EULL,
+    0x9C1633264DB49C89ULL, 0xB3F22C3D0B0B38EDULL, 0x390E5FB44D01144BULL, 0x5BFEA5B4712768E9ULL,
+    0x1E1032911FA78984ULL, 0x9A74ACB964E78CB3ULL, 0x4F80F7A035DAFB04ULL, 0x6304D09A0B3738C4ULL,
+    0x2171E64683023A08ULL, 0x5B9B63EB9CEFF80CULL, 0x506AACF489889342ULL, 0x1881AFC9A3A701D6ULL,
+    0x6503080440750644ULL, 0xDFD395339CDBF4A7ULL, 0xEF927DBCF00C20F2ULL, 0x7B32F7D1E03680ECULL,
+    0xB9FD7620E7316243ULL, 0x05A7E8A57DB91B77ULL, 0xB5889C6E15630A75ULL, 0x4A750A09CE9573F7ULL,
+    0xCF464CEC899A2F8AULL, 0xF538639CE705B824ULL, 0x3C79A0FF5580EF7FULL, 0xEDE6C87F8477609DULL,
+    0x799E81F05BC93F31ULL, 0x86536B8CF3428A8CULL, 0x97D7374C60087B73ULL, 0xA246637CFF328532ULL,
+    0x043FCAE60CC0EBA0ULL, 0x920E449535DD359EULL, 0x70EB093B15B290CCULL, 0x73A1921916591CBDULL,
+    0x56436C9FE1A1AA8DULL, 0xEFAC4B70633B8F81ULL, 0xBB215798D45DF7AFULL, 0x45F20042F24F1768ULL,
+    0x930F80F4E8EB7462ULL, 0xFF6712FFCFD75EA1ULL, 0xAE623FD67468AA70ULL, 0xDD2C5BC84BC8D8FCULL,
+    0x7EED120D54CF2DD9ULL, 0x22FE545401165F1CULL, 0xC91800E98FB99929ULL, 0x808BD68E6AC10365ULL,
+    0xDEC468145B7605F6ULL, 0x1BEDE3A3AEF53302ULL, 0x43539603D6C55602ULL, 0xAA969B5C691CCB7AULL,
+    0xA87832D392EFEE56ULL, 0x65942C7B3C7E11AEULL, 0xDED2D633CAD004F6ULL, 0x21F08570F420E565ULL,
+    0xB415938D7DA94E3CULL, 0x91B859E59ECB6350ULL, 0x10CFF333E0ED804AULL, 0x28AED140BE0BB7DDULL,
+    0xC5CC1D89724FA456ULL, 0x5648F680F11A2741ULL, 0x2D255069F0B7DAB3ULL, 0x9BC5A38EF729ABD4ULL,
+    0xEF2F054308F6A2BCULL, 0xAF2042F5CC5C2858ULL, 0x480412BAB7F5BE2AULL, 0xAEF3AF4A563DFE43ULL,
+    0x19AFE59AE451497FULL, 0x52593803DFF1E840ULL, 0xF4F076E65F2CE6F0ULL, 0x11379625747D5AF3ULL,
+    0xBCE5D2248682C115ULL, 0x9DA4243DE836994FULL, 0x066F70B33FE09017ULL, 0x4DC4DE189B671A1CULL,
+    0x51039AB7712457C3ULL, 0xC07A3F80C31FB4B4ULL, 0xB46EE9C5E64A6E7CULL, 0xB3819A42ABE61C87ULL,
+    0x21A007933A522A20ULL, 0x2DF16F761598AA4FULL, 0x763C4A1371B368FDULL, 0xF793C46702E086A0ULL,
+    0xD7288E012AEB8D31ULL, 0xDE336A2A4BC1C44BULL, 0x0BF692B38D079F23ULL, 0x2C604A7A177326B3ULL,
+    0x4850E73E03EB6064ULL, 0xCFC447F1E53C8E1BULL, 0xB05CA3F564268D99ULL, 0x9AE182C8BC9474E8ULL,
+    0xA4FC4BD4FC5558CAULL, 0xE755178D58FC4E76ULL, 0x69B97DB1A4C03DFEULL, 0xF9B5B7C4ACC67C96ULL,
+    0xFC6A82D64B8655FBULL, 0x9C684CB6C4D24417ULL, 0x8EC97D2917456ED0ULL, 0x6703DF9D2924E97EULL,
+    0xC547F57E42A7444EULL, 0x78E37644E7CAD29EULL, 0xFE9A44E9362F05FAULL, 0x08BD35CC38336615ULL,
+    0x9315E5EB3A129ACEULL, 0x94061B871E04DF75ULL, 0xDF1D9F9D784BA010ULL, 0x3BBA57B68871B59DULL,
+    0xD2B7ADEEDED1F73FULL, 0xF7A255D83BC373F8ULL, 0xD7F4F2448C0CEB81ULL, 0xD95BE88CD210FFA7ULL,
+    0x336F52F8FF4728E7ULL, 0xA74049DAC312AC71ULL, 0xA2F61BB6E437FDB5ULL, 0x4F2A5CB07F6A35B3ULL,
+    0x87D380BDA5BF7859ULL, 0x16B9F7E06C453A21ULL, 0x7BA2484C8A0FD54EULL, 0xF3A678CAD9A2E38CULL,
+    0x39B0BF7DDE437BA2ULL, 0xFCAF55C1BF8A4424ULL, 0x18FCF680573FA594ULL, 0x4C0563B89F495AC3ULL,
+    0x40E087931A00930DULL, 0x8CFFA9412EB642C1ULL, 0x68CA39053261169FULL, 0x7A1EE967D27579E2ULL,
+    0x9D1D60E5076F5B6FULL, 0x3810E399B6F65BA2ULL, 0x32095B6D4AB5F9B1ULL, 0x35CAB62109DD038AULL,
+    0xA90B24499FCFAFB1ULL, 0x77A225A07CC2C6BDULL, 0x513E5E634C70E331ULL, 0x4361C0CA3F692F12ULL,
+    0xD941ACA44B20A45BULL, 0x528F7C8602C5807BULL, 0x52AB92BEB9613989ULL, 0x9D1DFA2EFC557F73ULL,
+    0x722FF175F572C348ULL, 0x1D1260A51107FE97ULL, 0x7A249A57EC0C9BA2ULL, 0x04208FE9E8F7F2D6ULL,
+    0x5A110C6058B920A0ULL, 0x0CD9A497658A5698ULL, 0x56FD23C8F9715A4CULL, 0x284C847B9D887AAEULL,
+    0x04FEABFBBDB619CBULL, 0x742E1E651C60BA83ULL, 0x9A9632E65904AD3CULL, 0x881B82A13B51B9E2ULL,
+    0x506E6744CD974924ULL, 0xB0183DB56FFC6A79ULL, 0x0ED9B915C66ED37EULL, 0x5E11E86D5873D484ULL,
+    0xF678647E3519AC6EULL, 0x1B85D488D0F20CC5ULL, 0xDAB9FE6525D89021ULL, 0x0D151D86ADB73615ULL,
+    0xA865A54EDCC0F019ULL, 0x93C42566AEF98FFBULL, 0x99E7AFEABE000731ULL, 0x48CBFF086DDF285AULL,
+    0x7F9B6AF1EBF78BAFULL, 0x58627E1A149BBA21ULL, 0x2CD16E2ABD791E33ULL, 0xD363EFF5F0977996ULL,
+    0x0CE2A38C344A6EEDULL, 0x1A804AADB9CFA741ULL, 0x907F30421D78C5DEULL, 0x501F65EDB3034D07ULL,
+    0x37624AE5A48FA6E9ULL, 0x957BAF61700CFF4EULL, 0x3A6C27934E31188AULL, 0xD49503536ABCA345ULL,
+    0x088E049589C432E0ULL, 0xF943AEE7FEBF21B8ULL, 0x6C3B8E3E336139D3ULL, 0x364F6FFA464EE52EULL,
+    0xD60F6DCEDC314222ULL, 0x56963B0DCA418FC0ULL, 0x16F50EDF91E513AFULL, 0xEF1955914B609F93ULL,
+    0x565601C0364E3228ULL, 0xECB53939887E8175ULL, 0xBAC7A9A18531294BULL, 0xB344C470397BBA52ULL,
+    0x65D34954DAF3CEBDULL, 0xB4B81B3FA97511E2ULL, 0xB422061193D6F6A7ULL, 0x071582401C38434DULL,
+    0x7A13F18BBEDC4FF5ULL, 0xBC4097B116C524D2ULL, 0x59B97885E2F2EA28ULL, 0x99170A5DC3115544ULL,
+    0x6F423357E7C6A9F9ULL, 0x325928EE6E6F8794ULL, 0xD0E4366228B03343ULL, 0x565C31F7DE89EA27ULL,
+    0x30F5611484119414ULL, 0xD873DB391292ED4FULL, 0x7BD94E1D8E17DEBCULL, 0xC7D9F16864A76E94ULL,
+    0x947AE053EE56E63CULL, 0xC8C93882F9475F5FULL, 0x3A9BF55BA91F81CAULL, 0xD9A11FBB3D9808E4ULL,
+    0x0FD22063EDC29FCAULL, 0xB3F256D8ACA0B0B9ULL, 0xB03031A8B4516E84ULL, 0x35DD37D5871448AFULL,
+    0xE9F6082B05542E4EULL, 0xEBFAFA33D7254B59ULL, 0x9255ABB50D532280ULL, 0xB9AB4CE57F2D34F3ULL,
+    0x693501D628297551ULL, 0xC62C58F97DD949BFULL, 0xCD454F8F19C5126AULL, 0xBBE83F4ECC2BDECBULL,
+    0xDC842B7E2819E230ULL, 0xBA89142E007503B8ULL, 0xA3BC941D0A5061CBULL, 0xE9F6760E32CD8021ULL,
+    0x09C7E552BC76492FULL, 0x852F54934DA55CC9ULL, 0x8107FCCF064FCF56ULL, 0x098954D51FFF6580ULL,
+    0x23B70EDB1955C4BFULL, 0xC330DE426430F69DULL, 0x4715ED43E8A45C0AULL, 0xA8D7E4DAB780A08DULL,
+    0x0572B974F03CE0BBULL, 0xB57D2E985E1419C7ULL, 0xE8D9ECBE2CF3D73FULL, 0x2FE4B17170E59750ULL,
+    0x11317BA87905E790ULL, 0x7FBF21EC8A1F45ECULL, 0x1725CABFCB045B00ULL, 0x964E915CD5E2B207ULL,
+    0x3E2B8BCBF016D66DULL, 0xBE7444E39328A0ACULL, 0xF85B2B4FBCDE44B7ULL, 0x49353FEA39BA63B1ULL,
+    0x1DD01AAFCD53486AULL, 0x1FCA8A92FD719F85ULL, 0xFC7C95D827357AFAULL, 0x18A6A990C8B35EBDULL,
+    0xCCCB7005C6B9C28DULL, 0x3BDBB92C43B17F26ULL, 0xAA70B5B4F89695A2ULL, 0xE94C39A54A98307FULL,
+    0xB7A0B174CFF6F36EULL, 0xD4DBA84729AF48ADULL, 0x2E18BC1AD9704A68ULL, 0x2DE0966DAF2F8B1CULL,
+    0xB9C11D5B1E43A07EULL, 0x64972D68DEE33360ULL, 0x94628D38D0C20584ULL, 0xDBC0D2B6AB90A559ULL,
+    0xD2733C4335C6A72FULL, 0x7E75D99D94A70F4DULL, 0x6CED1983376FA72BULL, 0x97FCAACBF030BC24ULL,
+    0x7B77497B32503B12ULL, 0x8547EDDFB81CCB94ULL, 0x79999CDFF70902CBULL, 0xCFFE1939438E9B24ULL,
+    0x829626E3892D95D7ULL, 0x92FAE24291F2B3F1ULL, 0x63E22C147B9C3403ULL, 0xC678B6D860284A1CULL,
+    0x5873888850659AE7ULL, 0x0981DCD296A8736DULL, 0x9F65789A6509A440ULL, 0x9FF38FED72E9052FULL,
+    0xE479EE5B9930578CULL, 0xE7F28ECD2D49EECDULL, 0x56C074A581EA17FEULL, 0x5544F7D774B14AEFULL,
+    0x7B3F0195FC6F290FULL, 0x12153635B2C0CF57ULL, 0x7F5126DBBA5E0CA7ULL, 0x7A76956C3EAFB413ULL,
+    0x3D5774A11D31AB39ULL, 0x8A1B083821F40CB4ULL, 0x7B4A38E32537DF62ULL, 0x950113646D1D6E03ULL,
+    0x4DA8979A0041E8A9ULL, 0x3BC36E078F7515D7ULL, 0x5D0A12F27AD310D1ULL, 0x7F9D1A2E1EBE1327ULL,
+    0xDA3A361B1C5157B1ULL, 0xDCDD7D20903D0C25ULL, 0x36833336D068F707ULL, 0xCE68341F79893389ULL,
+    0xAB9090168DD05F34ULL, 0x43954B3252DC25E5ULL, 0xB438C2B67F98E5E9ULL, 0x10DCD78E3851A492ULL,
+    0xDBC27AB5447822BFULL, 0x9B3CDB65F82CA382ULL, 0xB67B7896167B4C84ULL, 0xBFCED1B0048EAC50ULL,
+    0xA9119B60369FFEBDULL, 0x1FFF7AC80904BF45ULL, 0xAC12FB171817EEE7ULL, 0xAF08DA9177DDA93DULL,
+    0x1B0CAB936E65C744ULL, 0xB559EB1D04E5E932ULL, 0xC37B45B3F8D6F2BAULL, 0xC3A9DC228CAAC9E9ULL,
+    0xF3B8B6675A6507FFULL, 0x9FC477DE4ED681DAULL, 0x67378D8ECCEF96CBULL, 0x6DD856D94D259236ULL,
+    0xA319CE15B0B4DB31ULL, 0x073973751F12DD5EULL, 0x8A8E849EB32781A5ULL, 0xE1925C71285279F5ULL,
+    0x74C04BF1790C0EFEULL, 0x4DDA48153C94938AULL, 0x9D266D6A1CC0542CULL, 0x7440FB816508C4FEULL,
+    0x13328503DF48229FULL, 0xD6BF7BAEE43CAC40ULL, 0x4838D65F6EF6748FULL, 0x1E152328F3318DEAULL,
+    0x8F8419A348F296BFULL, 0x72C8834A5957B511ULL, 0xD7A023A73260B45CULL, 0x94EBC8ABCFB56DAEULL,
+    0x9FC10D0F989993E0ULL, 0xDE68A2355B93CAE6ULL, 0xA44CFE79AE538BBEULL, 0x9D1D84FCCE371425ULL,
+    0x51D2B1AB2DDFB636ULL, 0x2FD7E4B9E72CD38CULL, 0x65CA5B96B7552210ULL, 0xDD69A0D8AB3B546DULL,
+    0x604D51B25FBF70E2ULL, 0x73AA8A564FB7AC9EULL, 0x1A8C1E992B941148ULL, 0xAAC40A2703D9BEA0ULL,
+    0x764DBEAE7FA4F3A6ULL, 0x1E99B96E70A9BE8BULL, 0x2C5E9DEB57EF4743ULL, 0x3A938FEE32D29981ULL,
+    0x26E6DB8FFDF5ADFEULL, 0x469356C504EC9F9DULL, 0xC8763C5B08D1908CULL, 0x3F6C6AF859D80055ULL,
+    0x7F7CC39420A3A545ULL, 0x9BFB227EBDF4C5CEULL, 0x89039D79D6FC5C5CULL, 0x8FE88B57305E2AB6ULL,
+    0xA09E8C8C35AB96DEULL, 0xFA7E393983325753ULL, 0xD6B6D0ECC617C699ULL, 0xDFEA21EA9E7557E3ULL,
+    0xB67C1FA481680AF8ULL, 0xCA1E3785A9E724E5ULL, 0x1CFC8BED0D681639ULL, 0xD18D8549D140CAEAULL,
+    0x4ED0FE7E9DC91335ULL, 0xE4DBF0634473F5D2ULL, 0x1761F93A44D5AEFEULL, 0x53898E4C3910DA55ULL,
+    0x734DE8181F6EC39AULL, 0x2680B122BAA28D97ULL, 0x298AF231C85BAFABULL, 0x7983EED3740847D5ULL,
+    0x66C1A2A1A60CD889ULL, 0x9E17E49642A3E4C1ULL, 0xEDB454E7BADC0805ULL, 0x50B704CAB602C329ULL,
+    0x4CC317FB9CDDD023ULL, 0x66B4835D9EAFEA22ULL, 0x219B97E26FFC81BDULL, 0x261E4E4C0A333A9DULL,
+    0x1FE2CCA76517DB90ULL, 0xD7504DFA8816EDBBULL, 0xB9571FA04DC089C8ULL, 0x1DDC0325259B27DEULL,
+    0xCF3F4688801EB9AAULL, 0xF4F5D05C10CAB243ULL, 0x38B6525C21A42B0EULL, 0x36F60E2BA4FA6800ULL,
+    0xEB3593803173E0CEULL, 0x9C4CD6257C5A3603ULL, 0xAF0C317D32ADAA8AULL, 0x258E5A80C7204C4BULL,
+    0x8B889D624D44885DULL, 0xF4D14597E660F855ULL, 0xD4347F66EC8941C3ULL, 0xE699ED85B0DFB40DULL,
+    0x2472F6207C2D0484ULL, 0xC2A1E7B5B459AEB5ULL, 0xAB4F6451CC1D45ECULL, 0x63767572AE3D6174ULL,
+    0xA59E0BD101731A28ULL, 0x116D0016CB948F09ULL, 0x2CF9C8CA052F6E9FULL, 0x0B090A7560A968E3ULL,
+    0xABEEDDB2DDE06FF1ULL, 0x58EFC10B06A2068DULL, 0xC6E57A78FBD986E0ULL, 0x2EAB8CA63CE802D7ULL,
+    0x14A195640116F336ULL, 0x7C0828DD624EC390ULL, 0xD74BBE77E6116AC7ULL, 0x804456AF10F5FB53ULL,
+    0xEBE9EA2ADF4321C7ULL, 0x03219A39EE587A30ULL, 0x49787FEF17AF9924ULL, 0xA1E9300CD8520548ULL,
+    0x5B45E522E4B1B4EFULL, 0xB49C3B3995091A36ULL, 0xD4490AD526F14431ULL, 0x12A8F216AF9418C2ULL,
+    0x001F837CC7350524ULL, 0x1877B51E57A764D5ULL, 0xA2853B80F17F58EEULL, 0x993E1DE72D36D310ULL,
+    0xB3598080CE64A656ULL, 0x252F59CF0D9F04BBULL, 0xD23C8E176D113600ULL, 0x1BDA0492E7E4586EULL,
+    0x21E0BD5026C619BFULL, 0x3B097ADAF088F94EULL, 0x8D14DEDB30BE846EULL, 0xF95CFFA23AF5F6F4ULL,
+    0x3871700761B3F743ULL, 0xCA672B91E9E4FA16ULL, 0x64C8E531BFF53B55ULL, 0x241260ED4AD1E87DULL,
+    0x106C09B972D2E822ULL, 0x7FBA195410E5CA30ULL, 0x7884D9BC6CB569D8ULL, 0x0647DFEDCD894A29ULL,
+    0x63573FF03E224774ULL, 0x4FC8E9560F91B123ULL, 0x1DB956E450275779ULL, 0xB8D91274B9E9D4FBULL,
+    0xA2EBEE47E2FBFCE1ULL, 0xD9F1F30CCD97FB09ULL, 0xEFED53D75FD64E6BULL, 0x2E6D02C36017F67FULL,
+    0xA9AA4D20DB084E9BULL, 0xB64BE8D8B25396C1ULL, 0x70CB6AF7C2D5BCF0ULL, 0x98F076A4F7A2322EULL,
+    0xBF84470805E69B5FULL, 0x94C3251F06F90CF3ULL, 0x3E003E616A6591E9ULL, 0xB925A6CD0421AFF3ULL,
+    0x61BDD1307C66E300ULL, 0xBF8D5108E27E0D48ULL, 0x240AB57A8B888B20ULL, 0xFC87614BAF287E07ULL,
+    0xEF02CDD06FFDB432ULL, 0xA1082C0466DF6C0AULL, 0x8215E577001332C8ULL, 0xD39BB9C3A48DB6CFULL,
+    0x2738259634305C14ULL, 0x61CF4F94C97DF93DULL, 0x1B6BACA2AE4E125BULL, 0x758F450C88572E0BULL,
+    0x959F587D507A8359ULL, 0xB063E962E045F54DULL, 0x60E8ED72C0DFF5D1ULL, 0x7B64978555326F9FULL,
+    0xFD080D236DA814BAULL, 0x8C90FD9B083F4558ULL, 0x106F72FE81E2C590ULL, 0x7976033A39F7D952ULL,
+    0xA4EC0132764CA04BULL, 0x733EA705FAE4FA77ULL, 0xB4D8F77BC3E56167ULL, 0x9E21F4F903B33FD9ULL,
+    0x9D765E419FB69F6DULL, 0xD30C088BA61EA5EFULL, 0x5D94337FBFAF7F5BULL, 0x1A4E4822EB4D7A59ULL,
+    0x6FFE73E81B637FB3ULL, 0xDDF957BC36D8B9CAULL, 0x64D0E29EEA8838B3ULL, 0x08DD9BDFD96B9F63ULL,
+    0x087E79E5A57D1D13ULL, 0xE328E230E3E2B3FBULL, 0x1C2559E30F0946BEULL, 0x720BF5F26F4D2EAAULL,
+    0xB0774D261CC609DBULL, 0x443F64EC5A371195ULL, 0x4112CF68649A260EULL, 0xD813F2FAB7F5C5CAULL,
+    0x660D3257380841EEULL, 0x59AC2C7873F910A3ULL, 0xE846963877671A17ULL, 0x93B633ABFA3469F8ULL,
+    0xC0C0F5A60EF4CDCFULL, 0xCAF21ECD4377B28CULL, 0x57277707199B8175ULL, 0x506C11B9D90E8B1DULL,
+    0xD83CC2687A19255FULL, 0x4A29C6465A314CD1ULL, 0xED2DF21216235097ULL, 0xB5635C95FF7296E2ULL,
+    0x22AF003AB672E811ULL, 0x52E762596BF68235ULL, 0x9AEBA33AC6ECC6B0ULL, 0x944F6DE09134DFB6ULL,
+    0x6C47BEC883A7DE39ULL, 0x6AD047C430A12104ULL, 0xA5B1CFDBA0AB4067ULL, 0x7C45D833AFF07862ULL,
+    0x5092EF950A16DA0BULL, 0x9338E69C052B8E7BULL, 0x455A4B4CFE30E3F5ULL, 0x6B02E63195AD0CF8ULL,
+    0x6B17B224BAD6BF27ULL, 0xD1E0CCD25BB9C169ULL, 0xDE0C89A556B9AE70ULL, 0x50065E535A213CF6ULL,
+    0x9C1169FA2777B874ULL, 0x78EDEFD694AF1EEDULL, 0x6DC93D9526A50E68ULL, 0xEE97F453F06791EDULL,
+    0x32AB0EDB696703D3ULL, 0x3A6853C7E70757A7ULL, 0x31865CED6120F37DULL, 0x67FEF95D92607890ULL,
+    0x1F2B1D1F15F6DC9CULL, 0xB69E38A8965C6B65ULL, 0xAA9119FF184CCCF4ULL, 0xF43C732873F24C13ULL,
+    0xFB4A3D794A9A80D2ULL, 0x3550C2321FD6109CULL, 0x371F77E76BB8417EULL, 0x6BFA9AAE5EC05779ULL,
+    0xCD04F3FF001A4778ULL, 0xE3273522064480CAULL, 0x9F91508BFFCFC14AULL, 0x049A7F41061A9E60ULL,
+    0xFCB6BE43A9F2FE9BULL, 0x08DE8A1C7797DA9BULL, 0x8F9887E6078735A1ULL, 0xB5B4071DBFC73A66ULL,
+    0x230E343DFBA08D33ULL, 0x43ED7F5A0FAE657DULL, 0x3A88A0FBBCB05C63ULL, 0x21874B8B4D2DBC4FULL,
+    0x1BDEA12E35F6A8C9ULL, 0x53C065C6C8E63528ULL, 0xE34A1D250E7A8D6BULL, 0xD6B04D3B7651DD7EULL,
+    0x5E90277E7CB39E2DULL, 0x2C046F22062DC67DULL, 0xB10BB459132D0A26ULL, 0x3FA9DDFB67E2F199ULL,
+    0x0E09B88E1914F7AFULL, 0x10E8B35AF3EEAB37ULL, 0x9EEDECA8E272B933ULL, 0xD4C718BC4AE8AE5FULL,
+    0x81536D601170FC20ULL, 0x91B534F885818A06ULL, 0xEC8177F83F900978ULL, 0x190E714FADA5156EULL,
+    0xB592BF39B0364963ULL, 0x89C350C893AE7DC1ULL, 0xAC042E70F8B383F2ULL, 0xB49B52E587A1EE60ULL,
+    0xFB152FE3FF26DA89ULL, 0x3E666E6F69AE2C15ULL, 0x3B544EBE544C19F9ULL, 0xE805A1E290CF2456ULL,
+    0x24B33C9D7ED25117ULL, 0xE74733427B72F0C1ULL, 0x0A804D18B7097475ULL, 0x57E3306D881EDB4FULL,
+    0x4AE7D6A36EB5DBCBULL, 0x2D8D5432157064C8ULL, 0xD1E649DE1E7F268BULL, 0x8A328A1CEDFE552CULL,
+    0x07A3AEC79624C7DAULL, 0x84547DDC3E203C94ULL, 0x990A98FD5071D263ULL, 0x1A4FF12616EEFC89ULL,
+    0xF6F7FD1431714200ULL, 0x30C05B1BA332F41CULL, 0x8D2636B81555A786ULL, 0x46C9FEB55D120902ULL,
+    0xCCEC0A73B49C9921ULL, 0x4E9D2827355FC492ULL, 0x19EBB029435DCB0FULL, 0x4659D2B743848A2CULL,
+    0x963EF2C96B33BE31ULL, 0x74F85198B05A2E7DULL, 0x5A0F544DD2B1FB18ULL, 0x03727073C2E134B1ULL,
+    0xC7F6AA2DE59AEA61ULL, 0x352787BAA0D7C22FULL, 0x9853EAB63B5E0B35ULL, 0xABBDCDD7ED5C0860ULL,
+    0xCF05DAF5AC8D77B0ULL, 0x49CAD48CEBF4A71EULL, 0x7A4C10EC2158C4A6ULL, 0xD9E92AA246BF719EULL,
+    0x13AE978D09FE5556ULL, 0x730499AF921549FFULL, 0x4E4B705B92903BA4ULL, 0xFF577222C14F0A3AULL,
+    0x55B6344CF97AAFAEULL, 0xB862225B055B6960ULL, 0xCAC09AFBDDD2CDB4ULL, 0xDAF8E9829FE96B5FULL,
+    0xB5FDFC5D3132C498ULL, 0x310CB380DB6F7503ULL, 0xE87FBB46217A360EULL, 0x2102AE466EBB1148ULL,
+    0xF8549E1A3AA5E00DULL, 0x07A69AFDCC42261AULL, 0xC4C118BFE78FEAAEULL, 0xF9F4892ED96BD438ULL,
+    0x1AF3DBE25D8F45DAULL, 0xF5B4B0B0D2DEEEB4ULL, 0x962ACEEFA82E1C84ULL, 0x046E3ECAAF453CE9ULL,
+    0xF05D129681949A4CULL, 0x964781CE734B3C84ULL, 0x9C2ED44081CE5FBDULL, 0x522E23F3925E319EULL,
+    0x177E00F9FC32F791ULL, 0x2BC60A63A6F3B3F2ULL, 0x222BBFAE61725606ULL, 0x486289DDCC3D6780ULL,
+    0x7DC7785B8EFDFC80ULL, 0x8AF38731C02BA980ULL, 0x1FAB64EA29A2DDF7ULL, 0xE4D9429322CD065AULL,
+    0x9DA058C67844F20CULL, 0x24C0E332B70019B0ULL, 0x233003B5A6CFE6ADULL, 0xD586BD01C5C217F6ULL,
+    0x5E5637885F29BC2BULL, 0x7EBA726D8C94094BULL, 0x0A56A5F0BFE39272ULL, 0xD79476A84EE20D06ULL,
+    0x9E4C1269BAA4BF37ULL, 0x17EFEE45B0DEE640ULL, 0x1D95B0A5FCF90BC6ULL, 0x93CBE0B699C2585DULL,
+    0x65FA4F227A2B6D79ULL, 0xD5F9E858292504D5ULL, 0xC2B5A03F71471A6FULL, 0x59300222B4561E00ULL,
+    0xCE2F8642CA0712DCULL, 0x7CA9723FBB2E8988ULL, 0x2785338347F2BA08ULL, 0xC61BB3A141E50E8CULL,
+    0x150F361DAB9DEC26ULL, 0x9F6A419D382595F4ULL, 0x64A53DC924FE7AC9ULL, 0x142DE49FFF7A7C3DULL,
+    0x0C335248857FA9E7ULL, 0x0A9C32D5EAE45305ULL, 0xE6C42178C4BBB92EULL, 0x71F1CE2490D20B07ULL,
+    0xF1BCC3D275AFE51AULL, 0xE728E8C83C334074ULL, 0x96FBF83A12884624ULL, 0x81A1549FD6573DA5ULL,
+    0x5FA7867CAF35E149ULL, 0x56986E2EF3ED091BULL, 0x917F1DD5F8886C61ULL, 0xD20D8C88C8FFE65FULL,
+    0x31D71DCE64B2C310ULL, 0xF165B587DF898190ULL, 0xA57E6339DD2CF3A1ULL, 0x1EF6E6DBB1961EC9ULL,
+    0x70CC73D90BC26E24ULL, 0xE21A6B35DF0C3AD7ULL, 0x003A93D8B2806962ULL, 0x1C99DED33CB890A1ULL,
+    0xCF3145DE0ADD4289ULL, 0xD0E4427A5514FB72ULL, 0x77C621CC9FB3A483ULL, 0x67A34DAC4356550BULL,
+    0xF8D626AAAF278509ULL,
+};
+
+struct book_entry {
+    uint8_t key[8];
+    uint8_t move[2];
+    uint8_t weight[2];
+    uint8_t learn[4];
+};
+static_assert(sizeof(struct book_entry) == 16, "book_entry must match the Polyglot format");
+
+static struct {
+    const struct book_entry* entries;
+    size_t                   n;
+    bool                     best;  /* always play the highest weight instead of a weighted pick */
+    uint64_t                 seed;
+} book;
+
+static inline uint64_t read_be(const uint8_t* p, size_t bytes)
+{
+    uint64_t x = 0;
+    for (size_t i = 0; i < bytes; i++)
+        x = x << 8 | p[i];
+    return x;
+}
+
+static bool book_open(const char* path)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    const long size = ftell(f);
+
+    void* map = size > 0 ? mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(f), 0) : MAP_FAILED;
+    fclose(f);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "%s: can't map the book\n", path);
+        return false;
+    }
+
+    book.entries = map;
+    book.n       = size / sizeof(struct book_entry);
+    book.seed    = (uint64_t)now_ms() | 1;
+    return true;
+}
+
+/* the key of the position in Polyglot's scheme */
+static uint64_t book_key(struct game_state* g)
+{
+    /* Polyglot orders pieces pawn, knight, bishop, rook, queen, king with
+       black before white */
+    static const int kind[PIECE_COUNT] = {
+        [PAWN] = 0, [KNIGHT] = 1, [BISHOP] = 2, [ROOK] = 3, [QUEEN] = 4, [KING] = 5,
+    };
+
+    uint64_t key = 0;
+    for (index_t i = 0; i < BOARD_SIZE; i++) {
+        const piece_t p = g->board[i];
+        if (p != EMPTY)
+            key ^= polyglot_random[64 * (2 * kind[piece_abs(p)] + (p > 0)) + i];
+    }
+
+    const unsigned rights = castling_rights(g);
+    for (int i = 0; i < 4; i++) {
+        if (rights & 1 << i)
+            key ^= polyglot_random[POLYGLOT_CASTLE + i];
+    }
+
+    /* the en passant file only counts if a pawn can actually take */
+    const int ep = g->last_pawn_double_move_file;
+    if (ep >= 0) {
+        const index_t row = g->player == WHITE ? RANK_5 : RANK_4;
+        if ((ep > FILE_A && g->board[row + ep - 1] == g->player * PAWN)
+         || (ep < FILE_H && g->board[row + ep + 1] == g->player * PAWN))
+            key ^= polyglot_random[POLYGLOT_EN_PASSANT + ep];
+    }
+
+    if (g->player == WHITE)
+        key ^= polyglot_random[POLYGLOT_TURN];
+    return key;
+}
+
+/* Polyglot writes castling as the king taking its own rook */
+static move_t book_decode(struct game_state* g, uint16_t bm)
+{
+    static const enum chess_piece promotion[] = { EMPTY, KNIGHT, BISHOP, ROOK, QUEEN };
+
+    const index_t from = (bm >> 6) & 0x3F;
+    index_t       to   = bm & 0x3F;
+    const int     p    = (bm >> 12) & 0x7;
+
+    if (p > 4)
+        return MOVE_NONE;
+    if (piece_abs(g->board[from]) == KING && g->board[to] == g->player * ROOK)
+        to = to > from ? from + 2 : from - 2;
+
+    const move_t m = move_make(from, to, promotion[p]);
+    return move_ok(g, m) ? m : MOVE_NONE;
+}
+
+/* a move from the book for `g`, MOVE_NONE if the book doesn't have it */
+static move_t book_move(struct game_state* g)
+{
+    if (book.n == 0)
+        return MOVE_NONE;
+
+    const uint64_t key = book_key(g);
+
+    /* first entry with the key */
+    size_t lo = 0, hi = book.n;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (read_be(book.entries[mid].key, 8) < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    move_t   moves[MAX_MOVES];
+    uint64_t weights[MAX_MOVES];
+    size_t   n     = 0;
+    uint64_t total = 0;
+    for (size_t i = lo; i < book.n && n < MAX_MOVES && read_be(book.entries[i].key, 8) == key; i++) {
+        moves[n]   = book_decode(g, read_be(book.entries[i].move, 2));
+        weights[n] = read_be(book.entries[i].weight, 2);
+        if (moves[n] != MOVE_NONE && weights[n]) {
+            total += weights[n];
+            n++;
+        }
+    }
+    if (n == 0)
+        return MOVE_NONE;
+
+    size_t chosen = 0;
+    if (book.best) {
+        for (size_t i = 1; i < n; i++) {
+            if (weights[i] > weights[chosen])
+                chosen = i;
+        }
+    } else {
+        uint64_t pick = random_u64(&book.seed) % total;
+        while (pick >= weights[chosen])
+            pick -= weights[chosen++];
+    }
+    return moves[chosen];
+}
+
+/* Lazy SMP: search_threads threads search the same position, sharing only
+   the transposition table and stop flag. The main thread decides when to
+   stop, and the move of the deepest completed iteration of any thread is
+   played. `s` receives the main thread's search with the total node count. */
+static move_t computer_move(struct game_state* g, const struct search_limits* limits, struct search* s)
+{
+    const size_t n = search_threads ? search_threads : 1;
+
+    if (limits->book) {
+        const move_t m = book_move(g);
+        if (m != MOVE_NONE) {
+            search_start(s, g, limits);
+            s->stop    = NULL;
+            s->threads = NULL;
+            s->best    = m;
+            return m;
+        }
+    }
+
+    struct search* threads = calloc(n, sizeof *threads);
+    pthread_t*     ids     = calloc(n, sizeof *ids);
+    if (threads == NULL || ids == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    atomic_bool stop = false;
+
+    if (!limits->tt_aged)
+        tt_new_search();
+
+    for (size_t i = 0; i < n; i++) {
+        search_start(&threads[i], g, limits);
+        threads[i].start        = threads[0].start;
+        threads[i].stop         = &stop;
+        threads[i].threads      = threads;
+        threads[i].thread_count = n;
+        threads[i].id           = i;
+        threads[i].seed         = 0x9E3779B97F4A7C15ULL * (i + 1);
+    }
+
+    /* helpers inherit a mask blocking SIGINT, so the handler only ever runs
+       on the main thread, which owns sigint_state_copy */
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    for (size_t i = 1; i < n; i++) {
+        if (pthread_create(&ids[i], NULL, search_thread, &threads[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    iterative_deepening(&threads[0]);
+    atomic_store(&stop, true);
+
+    for (size_t i = 1; i < n; i++)
+        pthread_join(ids[i], NULL);
+
+    /* the first iteration is always allowed to finish */
+    if (threads[0].depth == 0) {
+        atomic_store(&stop, false);
+        threads[0].deadline     = 0;
+        threads[0].limits.nodes = 0;
+        threads[0].limits.abort = NULL;
+        search_root(&threads[0], &threads[0].g, 1);
+    }
+
+    struct search* best = &threads[0];
+    for (size_t i = 1; i < n; i++) {
+        if (threads[i].depth > best->depth && threads[i].best != MOVE_NONE)
+            best = &threads[i];
+    }
+
+    const uint64_t nodes = search_total_nodes(&threads[0]);
+    *s          = threads[0];
+    s->nodes    = nodes;
+    s->depth    = best->depth;
+    s->score    = best->score;
+    s->best     = best->best;
+    s->stop     = NULL;
+    s->threads  = NULL;
+
+    free(threads);
+    free(ids);
+    return s->best;
+}
+
+/* Pondering: while the human thinks, the engine searches the position after
+   the reply it expects, taken from the transposition table, or the current
+   position if it has no guess. On a hit the result can be played right away,
+   on a miss the table still holds much of the work. */
+struct ponder {
+    struct game_state    g;
+    struct history       history; /* the game's, with the guessed position on top */
+    struct search_limits limits;
+    struct search        s;
+    move_t               guess; /* the human move the search assumes, MOVE_NONE for none */
+    atomic_bool          abort;
+    pthread_t            thread;
+    bool                 running;
+};
+
+static void* ponder_thread(void* arg)
+{
+    struct ponder* p = arg;
+    computer_move(&p->g, &p->limits, &p->s);
+    return NULL;
+}
+
+/* starts pondering on the position `g`, in which the human is to move */
+static void ponder_start(struct ponder* p, struct game_state* g, const struct search_limits* limits)
+{
+    struct tt_entry e;
+
+    p->g     = *g;
+    p->guess = tt_probe(g->hash, &e) && e.move != MOVE_NONE && move_ok(g, e.move) ? e.move : MOVE_NONE;
+    p->g.history = NULL;
+    if (g->history) {
+        p->history   = *g->history;
+        p->g.history = &p->history;
+    }
+    if (p->guess != MOVE_NONE) {
+        move(&p->g, p->guess);
+        if (p->g.history)
+            history_push(&p->history, p->g.hash);
+    }
+
+    /* ponder as deep as the real search would go, with no clock */
+    const bool timed = limits->nodes || limits->movetime || limits->time[ATTR_WHITE];
+    p->limits = (struct search_limits){
+        .depth = limits->depth ? limits->depth : timed ? MAX_PLY : MAX_DEPTH,
+        .abort = &p->abort,
+    };
+
+    atomic_store(&p->abort, false);
+
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    p->running = pthread_create(&p->thread, NULL, ponder_thread, p) == 0;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* Stops pondering now that the human has moved to `g`. On a ponder hit that
+   has already searched as much as computer_move() would within `limits`,
+   returns its move and result in `s`, else MOVE_NONE. */
+static move_t ponder_stop(struct ponder* p, struct game_state* g, const struct search_limits* limits, struct search* s)
+{
+    if (!p->running)
+        return MOVE_NONE;
+
+    atomic_store(&p->abort, true);
+    pthread_join(p->thread, NULL);
+    p->running = false;
+
+    if (p->guess == MOVE_NONE || p->g.hash != g->hash || p->s.best == MOVE_NONE)
+        return MOVE_NONE;
+
+    /* what the real search would have been allowed */
+    int64_t   soft, hard;
+    const int depth = search_budget(limits, g->player, &soft, &hard);
+
+    const int64_t pondered = now_ms() - p->s.start;
+    if (p->s.depth < depth
+     && !(soft && pondered >= soft)
+     && !(limits->nodes && p->s.nodes >= limits->nodes)) {
+        return MOVE_NONE;
+    }
+
+    *s = p->s;
+    return s->best;
+}
+
+/* Measures how long 1, 2, 4, 8 and 16 threads take to reach the same depth
+   from an empty transposition table */
+static void smp_bench(struct game_state* g, const struct search_limits* limits)
+{
+    static const size_t thread_counts[] = { 1, 2, 4, 8, 16 };
+
+    struct search_limits l = *limits;
+    if (!l.depth)
+        l.depth = MAX_DEPTH + 3;
+
+    printf("time to depth %d\n", l.depth);
+    printf("%8s %10s %12s %12s %8s\n", "threads", "ms", "nodes", "nps", "speedup");
+
+    int64_t base = 0;
+    for (size_t i = 0; i < sizeof thread_counts / sizeof *thread_counts; i++) {
+        struct search s;
+
+        search_threads = thread_counts[i];
+        tt_clear();
+
+        const int64_t start = now_ms();
+        computer_move(g, &l, &s);
+        const int64_t ms = now_ms() - start;
+
+        if (i == 0)
+            base = ms;
+        printf("%8zu %10" PRId64 " %12" PRIu64 " %12" PRIu64 " %8.2f\n",
+               thread_counts[i], ms, s.nodes, s.nodes * 1000 / (ms ? ms : 1),
+               (double)base / (ms ? ms : 1));
+    }
+}
+
+/* Positions with published perft counts, indexed by depth. Zero where the
+   count is unknown or too big for perft_check(). */
+static const struct perft_position {
+    const char* name;
+    const char* fen;
+    uint64_t    nodes[7];
+} perft_positions[] = {
+    { "start",    START_FEN,
+      { 1, 20, 400, 8902, 197281, 4865609, 119060324 } },
+    { "kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+      { 1, 48, 2039, 97862, 4085603, 193690690 } },
+    { "pos3",     "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+      { 1, 14, 191, 2812, 43238, 674624, 11030083 } },
+    { "pos4",     "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+      { 1, 6, 264, 9467, 422333, 15833292 } },
+    { "pos5",     "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+      { 1, 44, 1486, 62379, 2103487, 89941194 } },
+    { "pos6",     "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+      { 1, 46, 2079, 89890, 3894594, 164075551 } },
+};
+
+/* perft_check() skips depths with more leaves than this */
+#define PERFT_CHECK_MAX_NODES 20000000
+
+/* Optional table of subtree counts. Like the transposition table an entry
+   holds its key xor'ed with the data, here the count shifted over the depth. */
+struct perft_entry {
+    uint64_t key;
+    uint64_t data;
+};
+
+static struct {
+    struct perft_entry* entries;
+    size_t              n;
+} perft_table;
+
+static void perft_table_init(size_t megabytes)
+{
+    free(perft_table.entries);
+    perft_table.n       = megabytes * 1024 * 1024 / sizeof(struct perft_entry);
+    perft_table.entries = perft_table.n ? calloc(perft_table.n, sizeof(struct perft_entry)) : NULL;
+    if (perft_table.n && perft_table.entries == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static inline struct perft_entry* perft_entry(uint64_t key)
+{
+    return &perft_table.entries[(size_t)(((unsigned __int128)key * perft_table.n) >> 64)];
+}
+
+static bool perft_probe(uint64_t key, int depth, uint64_t* nodes)
+{
+    const struct perft_entry* e    = perft_entry(key);
+    const uint64_t            data = __atomic_load_n(&e->data, __ATOMIC_RELAXED);
+    if ((__atomic_load_n(&e->key, __ATOMIC_RELAXED) ^ data) != key || (data & 0xFF) != (uint64_t)depth)
+        return false;
+    *nodes = data >> 8;
     return true;
 }
 
-static void dump_game_state(struct game_state* g)
+static void perft_store(uint64_t key, int depth, uint64_t nodes)
 {
-    printf("\nstatic const struct game_state state = {");
-    printf("\n    .board = {");
-    int n;
-    for (int i=0; i<8; i++) {
-        printf("\n        ");
-        n = 10;
-        for (int j=0; j<8; j++) {
-            n = printf("%s,", piece_str(g->board[i*RANK+j]));
-            for (int k=0; k<10-n; k++) {
-                printf(" ");
-            }
-        }
+    struct perft_entry* e    = perft_entry(key);
+    const uint64_t      data = nodes << 8 | (uint64_t)depth;
+    __atomic_store_n(&e->data, data, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->key, key ^ data, __ATOMIC_RELAXED);
+}
+
+/* counts the leaves of the legal move tree `depth` plies deep */
+static uint64_t perft(struct game_state* g, int depth)
+{
+    if (depth == 0)
+        return 1;
+
+    uint64_t nodes = 0;
+    if (perft_table.n && depth > 1 && perft_probe(g->hash, depth, &nodes))
+        return nodes;
+
+    struct move_list moves;
+    legal_moves(g, &moves);
+    if (depth == 1)
+        return moves.n;
+
+    for (size_t i = 0; i < moves.n; i++) {
+        const struct undo u = move(g, moves.moves[i]);
+        nodes += perft(g, depth - 1);
+        unmove(g, moves.moves[i], &u);
     }
-    printf("\n    },");
-    printf("\n    .attr = {");
-    printf("\n        [0] = 0x%x,", g->attr[0]);
-    printf("\n        [1] = 0x%x,", g->attr[1]);
-    printf("\n    },");
-    printf("\n    .last_pawn_double_move_file = %d,", g->last_pawn_double_move_file);
-    printf("\n    .turns_without_captures = %d,", g->turns_without_captures);
-    printf("\n    .turns = %d,", g->turns);
-    printf("\n    .player = %s,", color_str[g->player]);
-    printf("\n};");
-    printf("\n");
+
+    if (perft_table.n)
+        perft_store(g->hash, depth, nodes);
+    return nodes;
 }
 
-static void game_init(struct game_state* g)
-{
-    // black pieces are prefixed by a minus (-)
-    // clang-format off
-#if 1
-    static const struct game_state start = {
-        .board = {
-       /*       A        B        C        D        E        F        G        H    */
-       /* 1 */  ROOK,    KNIGHT,  BISHOP,  QUEEN,   KING,    BISHOP,  KNIGHT,  ROOK,
-       /* 2 */  PAWN,    PAWN,    PAWN,    PAWN,    PAWN,    PAWN,    PAWN,    PAWN,
-       /* 3 */  EMPTY,   EMPTY,   EMPTY,   EMPTY,   EMPTY,   EMPTY,   EMPTY,   EMPTY,
-       /* 4 */  EMPTY,   EMPTY,   EMPTY,   EMPTY,   EMPTY,   EMPTY,   EMPTY,   EMPTY,
-       /* 5 */  EMPTY,   EMPTY,   EMPTY,   EMPTY,   EMPTY,   EMPTY,   EMPTY,   EMPTY,
-       /* 6 */  EMPTY,   EMPTY,   EMPTY,   EMPTY,   EMPTY,   EMPTY,   EMPTY,   EMPTY,
-       /* 7 */  -PAWN,   -PAWN,   -PAWN,   -PAWN,   -PAWN,   -PAWN,   -PAWN,   -PAWN,
-       /* 8 */  -ROOK,   -KNIGHT, -BISHOP, -QUEEN,  -KING,   -BISHOP, -KNIGHT, -ROOK,
-        },
-        .attr = {
-            [0] = E1 & KING_POSITION,
-            [1] = E8 & KING_POSITION,
-        },
-        .last_pawn_double_move_file = -1,
-        .turns_without_captures = 0,
-        .turns = 0,
-        .player = WHITE,
-    };
-#else
-    static const struct game_state start = {
-    .board = {
-        EMPTY,    EMPTY,    EMPTY,    EMPTY,    KING,     EMPTY,    EMPTY,    EMPTY,    
-        -QUEEN,   EMPTY,    EMPTY,    EMPTY,    EMPTY,    EMPTY,    EMPTY,    EMPTY,    
-        PAWN,     EMPTY,    PAWN,     EMPTY,    EMPTY,    EMPTY,    EMPTY,    PAWN,     
-        EMPTY,    PAWN,     EMPTY,    EMPTY,    BISHOP,   EMPTY,    EMPTY,    EMPTY,    
-        EMPTY,    -PAWN,    EMPTY,    EMPTY,    EMPTY,    EMPTY,    EMPTY,    EMPTY,    
-        -PAWN,    EMPTY,    EMPTY,    ROOK,     EMPTY,    EMPTY,    EMPTY,    EMPTY,    
-        -KING,    EMPTY,    EMPTY,    EMPTY,    EMPTY,    -KNIGHT,  ROOK,     EMPTY,    
-        EMPTY,    EMPTY,    EMPTY,    EMPTY,    QUEEN,    EMPTY,    EMPTY,    EMPTY,    
-    },
-    .attr = {
-        [0] = 0x1c4,
-        [1] = 0x1f0,
-    },
-    .last_pawn_double_move_file = -1,
-    .turns_without_captures = 2,
-    .turns = 145,
-    .player = BLACK,
+/* root moves are handed out to the perft threads one at a time */
+struct perft_job {
+    struct game_state        g;
+    const struct move_list*  moves;
+    uint64_t*                counts;
+    atomic_size_t*           next;
+    int                      depth;
 };
-#endif
-    // clang-format on  
 
-    *g = start;
-    sigint_state_copy = *g;
+static void* perft_thread(void* arg)
+{
+    struct perft_job* job = arg;
+
+    size_t i;
+    while ((i = atomic_fetch_add(job->next, 1)) < job->moves->n) {
+        const struct undo u = move(&job->g, job->moves->moves[i]);
+        job->counts[i] = perft(&job->g, job->depth - 1);
+        unmove(&job->g, job->moves->moves[i], &u);
+    }
+    return NULL;
 }
 
-static index_t input_to_index(char input[2])
+/* perft() with the root moves spread over search_threads threads, the count
+   below each root move goes to `counts` */
+static uint64_t perft_root(struct game_state* g, int depth, struct move_list* moves, uint64_t counts[MAX_MOVES])
 {
-    const int file = toupper(input[0])-'A';
-    const int rank = RANK*(input[1] - '1');
+    legal_moves(g, moves);
+    if (depth == 0)
+        return 1;
 
-    //printf("evaluated to index %d\n", file + rank);
+    const size_t n = search_threads < moves->n ? search_threads : (moves->n ? moves->n : 1);
 
-    if (file < FILE_A || file > FILE_H || rank < RANK_1 || rank > RANK_8)
-        return -1;
+    struct perft_job* jobs = calloc(n, sizeof *jobs);
+    pthread_t*        ids  = calloc(n, sizeof *ids);
+    if (jobs == NULL || ids == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
 
-    return file + rank;
+    atomic_size_t next = 0;
+    for (size_t i = 0; i < n; i++) {
+        jobs[i] = (struct perft_job){ .g = *g, .moves = moves, .counts = counts, .next = &next, .depth = depth };
+        if (i && pthread_create(&ids[i], NULL, perft_thread, &jobs[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    perft_thread(&jobs[0]);
+    for (size_t i = 1; i < n; i++)
+        pthread_join(ids[i], NULL);
+
+    free(jobs);
+    free(ids);
+
+    uint64_t nodes = 0;
+    for (size_t i = 0; i < moves->n; i++)
+        nodes += counts[i];
+    return nodes;
 }
 
-// TODO: Implement algebaric notation
-static bool player_move(struct game_state* g)
+/* `name` is either one of perft_positions or a FEN record */
+static bool perft_position(struct game_state* g, const char* name)
 {
-    char input[3] = { 0 };
+    for (size_t i = 0; i < sizeof perft_positions / sizeof *perft_positions; i++) {
+        if (strcmp(name, perft_positions[i].name) == 0)
+            return game_from_fen(g, perft_positions[i].fen);
+    }
+    return game_from_fen(g, name);
+}
 
-    int from = -1, to = -1;
+/* prints the leaf count and speed, and with `divide` the count below each root move */
+static void perft_run(struct game_state* g, int depth, bool divide)
+{
+    struct move_list moves;
+    uint64_t         counts[MAX_MOVES];
+
+    const int64_t  start = now_ms();
+    const uint64_t nodes = perft_root(g, depth, &moves, counts);
+    const int64_t  ms    = now_ms() - start;
+
+    if (divide && depth > 0) {
+        char buf[6];
+        for (size_t i = 0; i < moves.n; i++)
+            printf("%s: %" PRIu64 "\n", move_str(moves.moves[i], buf), counts[i]);
+        printf("\nmoves: %zu\n", moves.n);
+    }
+    printf("nodes: %" PRIu64 "\n", nodes);
+    printf("time: %" PRId64 " ms\n", ms);
+    printf("nps: %" PRIu64 "\n", nodes * 1000 / (ms ? ms : 1));
+}
 
-    printf("\nMove piece\nfrom: ");
-    scanf(" %2s", input);
+/* runs every perft_positions count up to PERFT_CHECK_MAX_NODES, returns
+   false if any is off */
+static bool perft_check(void)
+{
+    bool    ok    = true;
+    int64_t start = now_ms();
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < sizeof perft_positions / sizeof *perft_positions; i++) {
+        const struct perft_position* p = &perft_positions[i];
+        for (int depth = 1; depth < 7 && p->nodes[depth] && p->nodes[depth] <= PERFT_CHECK_MAX_NODES; depth++) {
+            struct game_state g;
+            struct move_list  moves;
+            uint64_t          counts[MAX_MOVES];
+
+            if (!game_from_fen(&g, p->fen)) {
+                printf("%-10s bad FEN\n", p->name);
+                ok = false;
+                break;
+            }
+            const uint64_t nodes = perft_root(&g, depth, &moves, counts);
+            total += nodes;
+            printf("%-10s depth %d %10" PRIu64 " %s\n", p->name, depth, nodes,
+                   nodes == p->nodes[depth] ? "ok" : "FAILED");
+            if (nodes != p->nodes[depth]) {
+                printf("%-10s expected %10" PRIu64 "\n", "", p->nodes[depth]);
+                ok = false;
+            }
+        }
+    }
 
-    from = input_to_index(input);
+    const int64_t ms = now_ms() - start;
+    printf("%s, %" PRIu64 " nodes in %" PRId64 " ms (%" PRIu64 " nps)\n", ok ? "all counts match" : "COUNTS DIFFER",
+           total, ms, total * 1000 / (ms ? ms : 1));
+    return ok;
+}
 
-    if (from == -1)
-        return false;
+/* writes a search score the way UCI does, "cp 35" or "mate -3" in moves */
+static const char* score_str(int score, char buf[24])
+{
+    if (score >= MATE_BOUND)
+        snprintf(buf, 24, "mate %d", (MATE_SCORE - score + 1) / 2);
+    else if (score <= -MATE_BOUND)
+        snprintf(buf, 24, "mate %d", -(MATE_SCORE + score) / 2);
+    else
+        snprintf(buf, 24, "cp %d", score);
+    return buf;
+}
 
-    //print_threatmap(valid_moves(g, from));
-    printf("\nto: ");
-    scanf(" %2s", input);
+/* Searches each FEN record read from `in`, one per line, within `limits`
+   and prints one line per position: the record followed by the best move,
+   score, depth, nodes and milliseconds spent. Blank lines and lines starting
+   with '#' are skipped. A FEN record carries no game history, so repetitions
+   of positions before it go unnoticed. */
+static void batch(FILE* in, const struct search_limits* limits)
+{
+    char*  line = NULL;
+    size_t size = 0;
 
-    to = input_to_index(input);
+    setvbuf(stdout, NULL, _IOLBF, 0);
 
-    if (to == -1)
+    while (getline(&line, &size, in) != -1) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        struct game_state g;
+        if (!game_from_fen(&g, line)) {
+            printf("%s; error bad FEN\n", line);
+            continue;
+        }
+
+        struct search s;
+        char          move_buf[6], score_buf[24];
+        const move_t  m = computer_move(&g, limits, &s);
+        printf("%s; bestmove %s score %s depth %d nodes %" PRIu64 " time %" PRId64 "\n", line,
+               m == MOVE_NONE ? "0000" : move_str(m, move_buf), score_str(s.score, score_buf),
+               s.depth, s.nodes, now_ms() - s.start);
+    }
+
+    free(line);
+}
+
+/* A small tactical suite for the epd mode, the first Win At Chess positions */
+static const char* const epd_builtin[] = {
+    "2rr3k/pp3pp1/1nnqbN1p/3pN3/2pP4/2P3Q1/PPB4P/R4RK1 w - - bm Qg6; id \"WAC.001\";",
+    "8/7p/5k2/5p2/p1p2P2/Pr1pPK2/1P1R3P/8 b - - bm Rxb2; id \"WAC.002\";",
+    "5rk1/1ppb3p/p1pb4/6q1/3P1p1r/2P1R2P/PP1BQ1P1/5RKN w - - bm Rg3; id \"WAC.003\";",
+    "r1bq2rk/pp3pbp/2p1p1pQ/7P/3P4/2PB1N2/PP3PPR/2KR4 w - - bm Qxh7+; id \"WAC.004\";",
+    "5k2/6pp/p1qN4/1p1p4/3P4/2PKP2Q/PP3r2/3R4 b - - bm Qc4+; id \"WAC.005\";",
+    "7k/p7/1R5K/6r1/6p1/6P1/8/8 w - - bm Rb7; id \"WAC.006\";",
+    "rnbqkb1r/pppp1ppp/8/4P3/6n1/7P/PPPNPPP1/R1BQKBNR b KQkq - bm Ne3; id \"WAC.007\";",
+    "r4q1k/p2bR1rp/2p2Q1N/5p2/5p2/2P5/PP3PPP/R5K1 w - - bm Rf7; id \"WAC.008\";",
+    "3q1rk1/p4pp1/2pb3p/3p4/6Pr/1PNQ4/P1PB1PP1/4RRK1 b - - bm Bh2+; id \"WAC.009\";",
+    "2br2k1/2q3rn/p2NppQ1/2p1P3/Pp5R/4P3/1P3PPP/3R2K1 w - - bm Rxh7; id \"WAC.010\";",
+};
+
+#define EPD_MAX_MOVES 8
+
+/* one EPD record and what the search made of it */
+struct epd_position {
+    char              id[32];
+    struct board      position;
+    uint64_t          key;               /* board_hash() of the position */
+    move_t            bm[EPD_MAX_MOVES]; /* best moves, any of them solves the position */
+    size_t            n_bm;
+    move_t            am[EPD_MAX_MOVES]; /* moves to avoid, none of them may be played */
+    size_t            n_am;
+
+    move_t   best;
+    int      depth;
+    int      solved_depth; /* the iteration from which on the answer was right, 0 if never */
+    int64_t  solved_ms;
+    uint64_t nodes;
+    int64_t  ms;
+};
+
+/* Drops the records of positions that came up earlier in the suite and
+   returns how many are left. The kept ones go into an open-addressed set
+   of their indices keyed by board_hash(), probed linearly. */
+static size_t epd_dedup(struct epd_position* positions, size_t n)
+{
+    size_t capacity = 16;
+    while (capacity < 2 * n)
+        capacity *= 2;
+    size_t* slots = calloc(capacity, sizeof *slots); /* index + 1, 0 if empty */
+    if (slots == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        const struct epd_position* first = NULL;
+        size_t                     j     = positions[i].key & (capacity - 1);
+        for (; slots[j]; j = (j + 1) & (capacity - 1)) {
+            const struct epd_position* p = &positions[slots[j] - 1];
+            if (p->key == positions[i].key && board_equal(&p->position, &positions[i].position)) {
+                first = p;
+                break;
+            }
+        }
+        if (first) {
+            fprintf(stderr, "skipping %s, the same position as %s\n", positions[i].id, first->id);
+            continue;
+        }
+        positions[kept] = positions[i];
+        slots[j]        = ++kept;
+    }
+    free(slots);
+    return kept;
+}
+
+static bool epd_solves(const struct epd_position* p, move_t m)
+{
+    if (m == MOVE_NONE)
         return false;
+    for (size_t i = 0; i < p->n_am; i++) {
+        if (p->am[i] == m)
+            return false;
+    }
+    for (size_t i = 0; i < p->n_bm; i++) {
+        if (p->bm[i] == m)
+            return true;
+    }
+    return p->n_bm == 0;
+}
+
+/* Reads an EPD record: the first four FEN fields followed by operations
+   separated by semicolons. Only bm, am and id are used, and a record needs
+   a bm or an am to be of any use here. */
+static bool epd_parse(struct epd_position* p, const char* line)
+{
+    memset(p, 0, sizeof *p);
+
+    const char* c = line;
+    for (int fields = 0; fields < 4; fields++) {
+        c += strspn(c, " \t");
+        c += strcspn(c, " \t");
+    }
 
-    if (!move_ok(g, from, to))
+    char fen[FEN_MAX];
+    if ((size_t)(c - line) >= sizeof fen)
+        return false;
+    memcpy(fen, line, c - line);
+    fen[c - line] = '\0';
+    struct game_state g;
+    if (!game_from_fen(&g, fen))
         return false;
+    game_pack(&g, &p->position);
+    p->key = board_hash(&p->position);
+
+    while (*c) {
+        char op[256];
+        const size_t len = strcspn(c, ";");
+        snprintf(op, sizeof op, "%.*s", (int)len, c);
+        c += len + (c[len] == ';');
+
+        char* save;
+        const char* code = strtok_r(op, " \t\"", &save);
+        if (code == NULL)
+            continue;
 
-    move(g, from, to);
+        if (strcmp(code, "id") == 0) {
+            const char* id = strtok_r(NULL, "\"", &save);
+            snprintf(p->id, sizeof p->id, "%s", id ? id : "");
+        } else if (strcmp(code, "bm") == 0 || strcmp(code, "am") == 0) {
+            move_t* moves = code[0] == 'b' ? p->bm : p->am;
+            size_t* n     = code[0] == 'b' ? &p->n_bm : &p->n_am;
+            for (const char* san; (san = strtok_r(NULL, " \t", &save)) != NULL;) {
+                const move_t m = move_parse(&g, san);
+                if (m == MOVE_NONE || *n == EPD_MAX_MOVES)
+                    return false;
+                moves[(*n)++] = m;
+            }
+        }
+    }
+    return p->n_bm || p->n_am;
+}
 
-    return true;
+/* remembers the first iteration from which on the main thread's move was right */
+static void epd_report(struct search* s, void* arg)
+{
+    struct epd_position* p = arg;
+
+    if (!epd_solves(p, s->best)) {
+        p->solved_depth = 0;
+    } else if (!p->solved_depth) {
+        p->solved_depth = s->depth;
+        p->solved_ms    = now_ms() - s->start;
+    }
 }
 
-static double heuristic(struct game_state* g, int depth)
+/* the positions are handed out to the epd workers one at a time */
+struct epd_job {
+    struct epd_position*        positions;
+    size_t                      n;
+    atomic_size_t*              next;
+    const struct search_limits* limits;
+};
+
+static void* epd_worker(void* arg)
 {
-    if (draw(g))
-        return 0;
+    struct epd_job* job = arg;
+
+    size_t i;
+    while ((i = atomic_fetch_add(job->next, 1)) < job->n) {
+        struct epd_position* p = &job->positions[i];
+        struct search_limits l = *job->limits;
+        struct search        s;
+        struct game_state    g;
+        char                 san[SAN_MAX];
+
+        l.report     = epd_report;
+        l.report_arg = p;
+
+        game_unpack(&p->position, &g);
+        p->best  = computer_move(&g, &l, &s);
+        p->depth = s.depth;
+        p->nodes = s.nodes;
+        p->ms    = now_ms() - s.start;
+        if (!epd_solves(p, p->best))
+            p->solved_depth = 0;
+
+        if (p->solved_depth) {
+            printf("%-12s solved  %-8s depth %2d, first at depth %2d after %6" PRId64 " ms\n",
+                   p->id, move_san(&g, p->best, san), p->depth, p->solved_depth, p->solved_ms);
+        } else {
+            printf("%-12s FAILED  %-8s depth %2d\n",
+                   p->id, p->best == MOVE_NONE ? "-" : move_san(&g, p->best, san), p->depth);
+        }
+    }
+    return NULL;
+}
 
-    if (checkmate(g))
-        return g->player * -10000 * depth;
+/* Searches every position of an EPD suite within `limits` with `workers`
+   positions at a time, and reports the solve rate and speed */
+static bool epd_run(FILE* in, const struct search_limits* limits, size_t workers)
+{
+    struct epd_position* positions = NULL;
+    size_t               n = 0, capacity = 0;
+    char*                line = NULL;
+    size_t               size = 0;
+    size_t               builtin = 0;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    for (;;) {
+        const char* record;
+        if (in) {
+            if (getline(&line, &size, in) == -1)
+                break;
+            line[strcspn(line, "\r\n")] = '\0';
+            record = line;
+        } else if (builtin < sizeof epd_builtin / sizeof *epd_builtin) {
+            record = epd_builtin[builtin++];
+        } else {
+            break;
+        }
+        if (record[0] == '\0' || record[0] == '#')
+            continue;
 
-    double score = 0;
-    for (index_t i=0; i<BOARD_SIZE; i++) {
-        const piece_t piece  = g->board[i];
-        const piece_t type = piece_abs(piece);
-        score += piece_color(piece) * piece_value[type] * piece_position_bonus[type][(g->player == WHITE ? i : BOARD_SIZE-i-1)];
+        if (n == capacity) {
+            capacity  = capacity ? 2 * capacity : 64;
+            positions = realloc(positions, capacity * sizeof *positions);
+            if (positions == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (!epd_parse(&positions[n], record)) {
+            fprintf(stderr, "skipping bad EPD record: %s\n", record);
+            continue;
+        }
+        if (positions[n].id[0] == '\0')
+            snprintf(positions[n].id, sizeof positions[n].id, "#%zu", n + 1);
+        n++;
     }
-    if (is_check(g, g->player)) {
-        score += g->player * -1.0;
+    free(line);
+    n = epd_dedup(positions, n);
+
+    if (workers < 1)
+        workers = 1;
+    if (workers > n && n)
+        workers = n;
+
+    /* the workers search side by side, so they share one table generation */
+    struct search_limits l = *limits;
+    l.tt_aged = true;
+    tt_new_search();
+
+    struct epd_job job     = { .positions = positions, .n = n, .next = &(atomic_size_t){ 0 }, .limits = &l };
+    pthread_t*     ids     = calloc(workers, sizeof *ids);
+    const int64_t  start   = now_ms();
+    if (ids == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
     }
-    return score;
+
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    for (size_t i = 1; i < workers; i++) {
+        if (pthread_create(&ids[i], NULL, epd_worker, &job) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    epd_worker(&job);
+    for (size_t i = 1; i < workers; i++)
+        pthread_join(ids[i], NULL);
+
+    const int64_t ms = now_ms() - start;
+
+    size_t   solved = 0;
+    uint64_t nodes  = 0;
+    int64_t  solve_ms = 0;
+    for (size_t i = 0; i < n; i++) {
+        nodes += positions[i].nodes;
+        if (positions[i].solved_depth) {
+            solved++;
+            solve_ms += positions[i].solved_ms;
+        }
+    }
+
+    printf("solved %zu/%zu in %" PRId64 " ms, %" PRId64 " ms to the solutions, %" PRIu64 " nodes (%" PRIu64 " nps)\n",
+           solved, n, ms, solve_ms, nodes, nodes * 1000 / (ms ? ms : 1));
+
+    free(ids);
+    free(positions);
+    return solved == n;
 }
 
-static void print_debug(struct game_state* g)
+/* The UCI front end. Commands are read on the main thread while the search
+   runs on its own, so stop and isready are answered right away. */
+static struct {
+    struct game_state    g;
+    struct history       history;
+    struct search_limits limits;
+    struct search_limits ponder_limits; /* the clock to search on after a ponderhit */
+    atomic_bool          abort;
+    pthread_t            thread;
+    bool                 searching;
+    bool                 huge_pages;
+
+    /* After go infinite or go ponder the result is held back until stop or
+       ponderhit, the search thread waits on `released` while `held` */
+    pthread_mutex_t      lock;
+    pthread_cond_t       released;
+    bool                 held;
+    bool                 ponderhit;
+} uci = { .lock = PTHREAD_MUTEX_INITIALIZER, .released = PTHREAD_COND_INITIALIZER };
+
+static void uci_report(struct search* s, void* arg)
 {
-    for (int i=0; i<2; i++) {
-        printf("%s:\n", color_str_capitalized[i]);
-        printf("    A king touched: %s\n",        bool_str[!!(g->attr[i] & KING_TOUCHED)]);
-        printf("    A rook touched: %s\n",        bool_str[!!(g->attr[i] & A_ROOK_TOUCHED)]);
-        printf("    H rook touched: %s\n",        bool_str[!!(g->attr[i] & H_ROOK_TOUCHED)]);
-        printf("    can king side castle: %s\n",  bool_str[castle_kingside_ok(g)]);
-        printf("    can queen side castle: %s\n", bool_str[castle_queenside_ok(g)]);
-        printf("    king pos: %s\n",              tile_str[g->attr[i] & KING_POSITION]);
-        printf("    king pos: %u\n",              g->attr[i] & KING_POSITION);
-        printf("    in check: %s\n",              bool_str[is_check(g, WHITE)]);
-    }
+    (void)arg;
+    char           score[24], best[6];
+    const int64_t  ms    = now_ms() - s->start;
+    const uint64_t nodes = search_total_nodes(s);
+
+    printf("info depth %d score %s nodes %" PRIu64 " nps %" PRIu64 " time %" PRId64 " pv %s\n",
+           s->depth, score_str(s->score, score), nodes, nodes * 1000 / (ms ? ms : 1), ms,
+           move_str(s->best, best));
+}
 
-    double score = heuristic(g, 1);
-    if (score == -INFINITY)
-        score = -999;
-    else if (score == INFINITY)
-        score = 999;
-    printf("Estimated score: %lf\n", score);
-    printf("Turns with no capture: %d\n", g->turns_without_captures);
+static void* uci_search(void* arg)
+{
+    (void)arg;
+    struct search s;
+    char          best[6];
+
+    move_t m = computer_move(&uci.g, &uci.limits, &s);
+
+    pthread_mutex_lock(&uci.lock);
+    while (uci.held)
+        pthread_cond_wait(&uci.released, &uci.lock);
+    const bool hit = uci.ponderhit;
+    uci.ponderhit  = false;
+    if (hit)
+        atomic_store(&uci.abort, false);
+    pthread_mutex_unlock(&uci.lock);
+
+    /* the move pondered on was played: search again on the clock, which
+       the hash table left by the ponder search makes quick to catch up */
+    if (hit)
+        m = computer_move(&uci.g, &uci.ponder_limits, &s);
+
+    printf("bestmove %s\n", m == MOVE_NONE ? "0000" : move_str(m, best));
+    return NULL;
 }
 
+/* ends an infinite or ponder search and lets its result out, going on to
+   search on the clock if `ponderhit` */
+static void uci_release(bool ponderhit)
+{
+    pthread_mutex_lock(&uci.lock);
+    uci.held      = false;
+    uci.ponderhit = ponderhit;
+    atomic_store(&uci.abort, true);
+    pthread_cond_signal(&uci.released);
+    pthread_mutex_unlock(&uci.lock);
+}
 
-static  void sigint_handler(int signal)
+/* waits for the running search to finish, after telling it to stop if `stop` */
+static void uci_wait(bool stop)
 {
-    (void)signal;
-    paint_board(&sigint_state_copy, -1, -1);
-    print_debug(&sigint_state_copy);
-    dump_game_state(&sigint_state_copy);
-    exit(0);
+    if (!uci.searching)
+        return;
+    if (stop)
+        uci_release(false);
+    pthread_join(uci.thread, NULL);
+    uci.searching = false;
 }
 
-static double alpha_beta(struct game_state* g, double alpha, double beta, int depth)
+/* position [startpos | fen <FEN>] [moves <move>...] */
+static void uci_position(char* args)
 {
-    if (checkmate(g)) {
-        return CHECKMATE_SCORE * (depth+1);
+    char  fen[FEN_MAX] = START_FEN;
+    char* save;
+    char* token = strtok_r(args, " \t", &save);
+
+    if (token && strcmp(token, "fen") == 0) {
+        fen[0] = '\0';
+        while ((token = strtok_r(NULL, " \t", &save)) && strcmp(token, "moves") != 0) {
+            const size_t len = strlen(fen);
+            snprintf(fen + len, sizeof fen - len, "%s%s", len ? " " : "", token);
+        }
+    } else if (token) {
+        token = strtok_r(NULL, " \t", &save);
     }
-    if (depth == 0) {
-        return heuristic(g, depth) * g->player;
+
+    const bool valid = game_from_fen(&uci.g, fen);
+    if (!valid) {
+        printf("info string invalid position %s\n", fen);
+        game_from_fen(&uci.g, START_FEN);
     }
+    uci.g.history = &uci.history;
+    uci.history.n = 0;
+    history_push(&uci.history, uci.g.hash);
+    if (!valid || token == NULL || strcmp(token, "moves") != 0)
+        return;
+
+    while ((token = strtok_r(NULL, " \t", &save)) != NULL) {
+        const move_t m = move_parse(&uci.g, token);
+        if (m == MOVE_NONE) {
+            printf("info string illegal move %s\n", token);
+            return;
+        }
+        move(&uci.g, m);
+        history_push(&uci.history, uci.g.hash);
+    }
+}
+
+/* go [wtime <ms>] [btime <ms>] [winc <ms>] [binc <ms>] [movetime <ms>] [depth <N>] [nodes <N>] [infinite] [ponder] */
+static void uci_go(char* args)
+{
+    struct search_limits* l = &uci.limits;
+    bool infinite = false, ponder = false;
 
-    double m = alpha;
+    *l = (struct search_limits){ .report = uci_report, .abort = &uci.abort, .book = book.n != 0 };
 
-    // TODO: avoid doubly nested for loop
-    for (int i=0; i<BOARD_SIZE; i++) {
-        if (!friends(g->board[i], g->player))
+    char* save;
+    for (char* token = strtok_r(args, " \t", &save); token; token = strtok_r(NULL, " \t", &save)) {
+        /* infinite and ponder take no value, the rest are "<name> <number>" */
+        if (strcmp(token, "infinite") == 0) {
+            infinite = true;
+            continue;
+        }
+        if (strcmp(token, "ponder") == 0) {
+            ponder = true;
             continue;
+        }
 
-        for (int j=0; j<BOARD_SIZE; j++) {
-            if (!move_ok(g, i, j))
-                continue;
+        const char*   value = strtok_r(NULL, " \t", &save);
+        const int64_t n     = value ? strtoll(value, NULL, 10) : 0;
+
+        if (strcmp(token, "wtime") == 0)
+            l->time[ATTR_WHITE] = n > 1 ? n : 1;
+        else if (strcmp(token, "btime") == 0)
+            l->time[ATTR_BLACK] = n > 1 ? n : 1;
+        else if (strcmp(token, "winc") == 0)
+            l->increment[ATTR_WHITE] = n;
+        else if (strcmp(token, "binc") == 0)
+            l->increment[ATTR_BLACK] = n;
+        else if (strcmp(token, "movetime") == 0)
+            l->movetime = n;
+        else if (strcmp(token, "depth") == 0)
+            l->depth = n < MAX_PLY ? (int)n : MAX_PLY;
+        else if (strcmp(token, "nodes") == 0)
+            l->nodes = n;
+    }
 
-            typeof(*g) restore = *g;
-            move(g, i, j);
-            double x = -alpha_beta(g, -beta, -(alpha > m ? alpha : m), depth-1);
-            *g = restore;
-            m = m > x ? m : x;
-            if (m >= beta) {
-                return m;
-            }
+    /* with no limits, search until stop */
+    if (!l->depth && !l->nodes && !l->movetime && !l->time[ATTR_WHITE] && !l->time[ATTR_BLACK])
+        l->depth = MAX_PLY;
+
+    /* a ponder search keeps the limits for after the ponderhit and runs
+       until then without any */
+    if (ponder) {
+        uci.ponder_limits = *l;
+        *l = (struct search_limits){ .depth = MAX_PLY, .report = uci_report, .abort = &uci.abort };
+    }
+
+    uci.held      = infinite || ponder;
+    uci.ponderhit = false;
+    atomic_store(&uci.abort, false);
+    if (pthread_create(&uci.thread, NULL, uci_search, NULL) != 0) {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+    uci.searching = true;
+}
+
+/* setoption name <Hash|Threads> value <N> */
+static void uci_setoption(char* args)
+{
+    char name[32];
+    long value;
+    if (sscanf(args, " name %31s value %ld", name, &value) != 2 || value < 1)
+        return;
+
+    if (strcasecmp(name, "Hash") == 0)
+        tt_init(value, uci.huge_pages);
+    else if (strcasecmp(name, "Threads") == 0)
+        search_threads = value;
+    else
+        printf("info string unknown option %s\n", name);
+}
+
+static void uci_loop(bool huge_pages)
+{
+    char*  line = NULL;
+    size_t size = 0;
+
+    uci.huge_pages = huge_pages;
+    game_from_fen(&uci.g, START_FEN);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    while (getline(&line, &size, stdin) != -1) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        char* args    = line + strspn(line, " \t");
+        char* command = strsep(&args, " \t");
+        if (args == NULL)
+            args = "";
+
+        if (strcmp(command, "uci") == 0) {
+            printf("id name chess\n");
+            printf("id author the chess authors\n");
+            printf("option name Hash type spin default %d min 1 max 65536\n", DEFAULT_HASH_MB);
+            printf("option name Threads type spin default 1 min 1 max 256\n");
+            printf("uciok\n");
+        } else if (strcmp(command, "isready") == 0) {
+            printf("readyok\n");
+        } else if (strcmp(command, "setoption") == 0) {
+            uci_wait(true);
+            uci_setoption(args);
+        } else if (strcmp(command, "ucinewgame") == 0) {
+            uci_wait(true);
+            tt_clear();
+        } else if (strcmp(command, "position") == 0) {
+            uci_wait(true);
+            uci_position(args);
+        } else if (strcmp(command, "go") == 0) {
+            uci_wait(true);
+            uci_go(args);
+        } else if (strcmp(command, "stop") == 0) {
+            uci_wait(true);
+        } else if (strcmp(command, "ponderhit") == 0) {
+            if (uci.searching && uci.held)
+                uci_release(true);
+        } else if (strcmp(command, "quit") == 0) {
+            break;
         }
     }
 
-    return m;
+    uci_wait(true);
+    free(line);
 }
 
-static void computer_move(struct game_state* g, int depth, index_t* from, index_t* to)
+static void usage(const char* argv0)
 {
-    double m = -INFINITY;
-    *from = -1;
-    *to = -1;
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "       %s [options] perft|divide <depth> [start|kiwipete|pos3-6|<FEN>]\n"
+        "       %s [options] perft-check\n"
+        "       %s [options] batch [file]\n"
+        "       %s [options] epd [file]\n"
+        "  --hash <MB>         transposition table size in megabytes (default %d)\n"
+        "  --huge-pages        back the transposition table with huge pages if possible\n"
+        "  --depth <N>         search at most N plies per move (default %d without other limits)\n"
+        "  --nodes <N>         search at most N nodes per move\n"
+        "  --movetime <ms>     search each move for this many milliseconds\n"
+        "  --clock <s>[+<s>]   play on a game clock with this many seconds and increment\n"
+        "  --threads <N>       search with N threads (default 1)\n"
+        "  --smp-bench         report time to depth for 1 to 16 threads and exit\n"
+        "  --perft-hash <MB>   cache perft subtree counts in a table of this size\n"
+        "  --fen <FEN>         start the game from this position\n"
+        "  --uci               speak UCI on stdin and stdout instead of playing\n"
+        "  --play <white|black> play this side yourself against the engine\n"
+        "  --no-ponder         don't search while waiting for your move\n"
+        "  --book <file.bin>   play the first moves from this Polyglot book\n"
+        "  --book-best         play the book move with the highest weight, not a weighted pick\n"
+        "  --help              show this message\n"
+        "  --workers <N>       epd mode searches N positions at once (default 1)\n"
+        "batch searches each FEN line of the file, or stdin, within the limits above\n"
+        "epd runs the bm/am suite in the file, or a built-in one, 1 s a position by default\n",
+        argv0, argv0, argv0, argv0, argv0, DEFAULT_HASH_MB, MAX_DEPTH);
+}
 
-    // TODO: avoid doubly nested for loop
-    for (int i=0; i<BOARD_SIZE; i++) {
-        if (!friends(g->board[i], g->player))
-            continue;
-        for (int j=0; j<BOARD_SIZE; j++) {
-            if (!move_ok(g, i, j))
-                continue;
-            
-            typeof(*g) restore = *g;
-            move(g, i, j);
-            if (checkmate(g)) {
-                *g = restore;
-                *to   = j;
-                *from = i;
-                return;
+int main(int argc, char** argv)
+{
+    size_t               hash_mb    = DEFAULT_HASH_MB;
+    bool                 huge_pages = false;
+    struct search_limits limits     = { 0 };
+    bool                 bench      = false;
+    size_t               perft_mb   = 0;
+    const char*          fen        = NULL;
+    size_t               workers    = 1;
+    bool                 uci_mode   = false;
+    enum color           human      = 0;
+    bool                 pondering  = true;
+    const char*          book_path  = NULL;
+
+    enum { OPT_HASH = 256, OPT_HUGE_PAGES, OPT_DEPTH, OPT_NODES, OPT_MOVETIME, OPT_CLOCK, OPT_THREADS, OPT_SMP_BENCH, OPT_PERFT_HASH, OPT_FEN, OPT_WORKERS, OPT_UCI, OPT_PLAY, OPT_NO_PONDER, OPT_BOOK, OPT_BOOK_BEST, OPT_HELP };
+    static const struct option long_options[] = {
+        { "hash",       required_argument, NULL, OPT_HASH },
+        { "huge-pages", no_argument,       NULL, OPT_HUGE_PAGES },
+        { "depth",      required_argument, NULL, OPT_DEPTH },
+        { "nodes",      required_argument, NULL, OPT_NODES },
+        { "movetime",   required_argument, NULL, OPT_MOVETIME },
+        { "clock",      required_argument, NULL, OPT_CLOCK },
+        { "threads",    required_argument, NULL, OPT_THREADS },
+        { "smp-bench",  no_argument,       NULL, OPT_SMP_BENCH },
+        { "perft-hash", required_argument, NULL, OPT_PERFT_HASH },
+        { "fen",        required_argument, NULL, OPT_FEN },
+        { "workers",    required_argument, NULL, OPT_WORKERS },
+        { "uci",        no_argument,       NULL, OPT_UCI },
+        { "play",       required_argument, NULL, OPT_PLAY },
+        { "no-ponder",  no_argument,       NULL, OPT_NO_PONDER },
+        { "book",       required_argument, NULL, OPT_BOOK },
+        { "book-best",  no_argument,       NULL, OPT_BOOK_BEST },
+        { "help",       no_argument,       NULL, OPT_HELP },
+        { 0 },
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+        case OPT_HASH:
+            hash_mb = strtoul(optarg, NULL, 10);
+            break;
+        case OPT_HUGE_PAGES:
+            huge_pages = true;
+            break;
+        case OPT_DEPTH:
+            limits.depth = atoi(optarg);
+            if (limits.depth > MAX_PLY)
+                limits.depth = MAX_PLY;
+            break;
+        case OPT_NODES:
+            limits.nodes = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_MOVETIME:
+            limits.movetime = strtoll(optarg, NULL, 10);
+            break;
+        case OPT_CLOCK: {
+            double base = 0, increment = 0;
+            if (sscanf(optarg, "%lf+%lf", &base, &increment) < 1) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
             }
-            double x = -alpha_beta(g, -INFINITY, -m, depth-1);
-            *g = restore;
-
-            if (x > m) {
-                //printf("considering %s to %s with score %lf\n", tile_str[i], tile_str[j], x);
-                m     = x;
-                *to   = j;
-                *from = i;
+            limits.time[ATTR_WHITE] = limits.time[ATTR_BLACK] = base * 1000;
+            limits.increment[ATTR_WHITE] = limits.increment[ATTR_BLACK] = increment * 1000;
+            break;
+        }
+        case OPT_THREADS:
+            search_threads = strtoul(optarg, NULL, 10);
+            if (search_threads < 1)
+                search_threads = 1;
+            break;
+        case OPT_SMP_BENCH:
+            bench = true;
+            break;
+        case OPT_PERFT_HASH:
+            perft_mb = strtoul(optarg, NULL, 10);
+            break;
+        case OPT_FEN:
+            fen = optarg;
+            break;
+        case OPT_WORKERS:
+            workers = strtoul(optarg, NULL, 10);
+            break;
+        case OPT_UCI:
+            uci_mode = true;
+            break;
+        case OPT_PLAY:
+            if (strcasecmp(optarg, "white") == 0) {
+                human = WHITE;
+            } else if (strcasecmp(optarg, "black") == 0) {
+                human = BLACK;
+            } else {
+                usage(argv[0]);
+                return EXIT_FAILURE;
             }
+            break;
+        case OPT_NO_PONDER:
+            pondering = false;
+            break;
+        case OPT_BOOK:
+            book_path = optarg;
+            break;
+        case OPT_BOOK_BEST:
+            book.best = true;
+            break;
+        case OPT_HELP:
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
         }
     }
-    assert(m != -INFINITY);
-}
 
-int main()
-{
     if(signal(SIGINT, sigint_handler) == SIG_ERR) {
         perror("Unable to catch SIGINT");
         exit(EXIT_FAILURE);
@@ -1099,9 +4253,93 @@ int main()
 
     setlocale(LC_ALL, "C.UTF-8");
 
+    init_tables();
+
+    if (optind < argc) {
+        const char* command = argv[optind];
+        perft_table_init(perft_mb);
+
+        if (strcmp(command, "perft-check") == 0)
+            return perft_check() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+        if ((strcmp(command, "perft") == 0 || strcmp(command, "divide") == 0)
+         && optind + 1 < argc && atoi(argv[optind + 1]) >= 0) {
+            struct game_state g;
+            const char*       position = optind + 2 < argc ? argv[optind + 2] : "start";
+            if (!perft_position(&g, position)) {
+                fprintf(stderr, "%s: not a position name or FEN: %s\n", argv[0], position);
+                return EXIT_FAILURE;
+            }
+            perft_run(&g, atoi(argv[optind + 1]), command[0] == 'd');
+            return EXIT_SUCCESS;
+        }
+
+        if (strcmp(command, "batch") == 0) {
+            const char* path = optind + 1 < argc ? argv[optind + 1] : "-";
+            FILE*       in   = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+            if (in == NULL) {
+                perror(path);
+                return EXIT_FAILURE;
+            }
+            tt_init(hash_mb, huge_pages);
+            batch(in, &limits);
+            if (in != stdin)
+                fclose(in);
+            return EXIT_SUCCESS;
+        }
+
+        if (strcmp(command, "epd") == 0) {
+            FILE* in = NULL;
+            if (optind + 1 < argc && (in = fopen(argv[optind + 1], "r")) == NULL) {
+                perror(argv[optind + 1]);
+                return EXIT_FAILURE;
+            }
+            if (!limits.depth && !limits.nodes && !limits.movetime)
+                limits.movetime = 1000;
+            tt_init(hash_mb, huge_pages);
+            const bool all = epd_run(in, &limits, workers);
+            if (in)
+                fclose(in);
+            return all ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    tt_init(hash_mb, huge_pages);
+
+    if (book_path) {
+        if (!book_open(book_path))
+            return EXIT_FAILURE;
+        limits.book = true;
+    }
+
+    if (uci_mode) {
+        uci_loop(huge_pages);
+        return EXIT_SUCCESS;
+    }
+
     struct game_state state = {};
 
-    game_init(&state);
+    if (!game_init(&state, fen)) {
+        fprintf(stderr, "%s: invalid FEN: %s\n", argv[0], fen);
+        return EXIT_FAILURE;
+    }
+
+    static struct history history;
+    state.history = &history;
+    history_push(&history, state.hash);
+
+    /* positions since the last capture or pawn move, for threefold repetition */
+    static struct boardset positions;
+    boardset_init(&positions, FIFTY_MOVE_PLIES + 1);
+    boardset_inc(&positions, &state);
+
+    if (bench) {
+        smp_bench(&state, &limits);
+        return EXIT_SUCCESS;
+    }
 
 #if 0
     paint_board(&state);
@@ -1115,33 +4353,61 @@ int main()
     bool player_intervention = false;
     //double sum               = debug_sum_pieces(&state);
     index_t from = -1, to = -1;
+    const bool clock = limits.time[ATTR_WHITE] != 0;
+    static struct ponder ponder;
 
     while (true) {
+        const int64_t turn_start = now_ms();
+        const int     p          = attr_index(state.player);
+
         printf("============================\n");
         paint_board(&state, from, to);
-        printf("est. score: %lf\n", heuristic(&state, 0));
+        printf("est. score: %.2f\n", state.score / 100.0);
         //print_debug(&state);
         //dump_game_state(&state);
 
-        if (player_intervention) {
+        if (player_intervention || state.player == human) {
+            if (pondering && !player_intervention)
+                ponder_start(&ponder, &state, &limits);
             intervene:
             while (player_move(&state) == 0) {
                 printf("Valid moves for %s:\n", state.player == WHITE ? "white" : "black");
             }
         } else {
             printf("%s to move, thinking...\n", state.player == WHITE ? "White" : "Black");
-            computer_move(&state, MAX_DEPTH, &from, &to);
-            if (from == -1 || to == -1) {
+            struct search s;
+            move_t        m   = ponder_stop(&ponder, &state, &limits, &s);
+            const bool    hit = m != MOVE_NONE;
+            if (!hit)
+                m = computer_move(&state, &limits, &s);
+            if (m == MOVE_NONE) {
                 printf("computer couldn't think, starting player intervention\n");
                 player_intervention = true;
                 goto intervene;
             }
-            assert(move_ok(&state, from, to));
-            move(&state, from, to);
-            printf("Did %s to %s\n", tile_str[from], tile_str[to]);
+            assert(move_ok(&state, m));
+            move(&state, m);
+            from = move_from(m);
+            to   = move_to(m);
+            printf("Did %s to %s (depth %d, %" PRIu64 " nodes, %" PRId64 " ms%s)\n",
+                   tile_str[from], tile_str[to], s.depth, s.nodes, now_ms() - turn_start,
+                   hit ? ", ponder hit" : "");
+        }
+
+        if (clock) {
+            limits.time[p] -= now_ms() - turn_start;
+            limits.time[p] += limits.increment[p];
+            if (limits.time[p] < 1)
+                limits.time[p] = 1;
         }
 
         sigint_state_copy = state;
+        history_push(&history, state.hash);
+        if (state.turns_without_captures == 0)
+            boardset_clear(&positions);
+        const int occurrences = boardset_inc(&positions, &state);
+        assert(state.hash == zobrist_hash(&state));
+        assert(state.score == material_score(&state));
 
         bool white_king = false;
         bool black_king = false;
@@ -1157,7 +4423,8 @@ int main()
         if (is_check(&state, state.player)) {
             printf("\n%s is in check!\n", state.player == WHITE ? "White" : "Black");
         }
-        if (checkmate(&state)) {
+        const enum game_status status = game_status(&state, NULL, occurrences >= 3);
+        if (status == GAME_CHECKMATE) {
             printf("\nCheckmate. %s won!\n", state.player == WHITE ? "Black" : "White");
             //print_debug(&state, player);
             paint_board(&state, from, to);
@@ -1166,14 +4433,15 @@ int main()
             raise(SIGINT);
             break;
         }
-        if (draw(&state)) {
-            printf("\nDraw!\n");
+        if (status != GAME_ONGOING) {
+            printf("\nDraw by %s!\n", game_status_str[status]);
             //print_debug(&state, player);
             paint_board(&state, from, to);
             break;
         }
     }
 
+    boardset_free(&positions);
     return EXIT_SUCCESS;
 }
 #endif
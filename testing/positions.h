@@ -0,0 +1,40 @@
+/* Shared by the tests that include chess.c: calls `visit` on every
+   position up to `depth` plies from each of perft_positions[], which
+   between them castle, capture en passant and promote. */
+
+static void walk_positions(struct game_state* g, int depth, void (*visit)(struct game_state*, void*), void* arg)
+{
+    visit(g, arg);
+    if (depth == 0)
+        return;
+
+    struct move_list moves;
+    legal_moves(g, &moves);
+    for (size_t i = 0; i < moves.n; i++) {
+        const struct undo u = move(g, moves.moves[i]);
+        walk_positions(g, depth - 1, visit, arg);
+        unmove(g, moves.moves[i], &u);
+    }
+}
+
+static bool walk_perft_positions(int depth, void (*visit)(struct game_state*, void*), void* arg)
+{
+    for (size_t i = 0; i < sizeof perft_positions / sizeof *perft_positions; i++) {
+        struct game_state g;
+        if (!game_from_fen(&g, perft_positions[i].fen))
+            return false;
+        walk_positions(&g, depth, visit, arg);
+    }
+    return true;
+}
+
+/* how many positions walk_perft_positions() visits */
+static size_t perft_positions_count(int depth)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < sizeof perft_positions / sizeof *perft_positions; i++) {
+        for (int d = 0; d <= depth; d++)
+            n += perft_positions[i].nodes[d];
+    }
+    return n;
+}
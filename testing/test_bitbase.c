@@ -0,0 +1,52 @@
+#define main chess_main
+#include "../src/chess.c"
+#undef main
+
+/* Known results from the bitbases, with either side to move and with the
+   strong side as black, where bitbase_probe() mirrors the board. */
+static const struct {
+    const char* fen;
+    int         result; /* for the player to move: 1 wins, 0 draws, -1 loses */
+} results[] = {
+    /* king in front of its pawn: the opposition decides */
+    { "8/1k6/8/1K6/1P6/8/8/8 w - - 0 1",  0 },
+    { "8/1k6/8/1K6/1P6/8/8/8 b - - 0 1", -1 },
+    { "8/8/8/1p6/1k6/8/1K6/8 w - - 0 1", -1 },
+    { "8/8/8/1p6/1k6/8/1K6/8 b - - 0 1",  0 },
+    /* the king on the sixth rank wins with either side to move */
+    { "1k6/8/1K6/1P6/8/8/8/8 w - - 0 1",  1 },
+    { "1k6/8/1K6/1P6/8/8/8/8 b - - 0 1", -1 },
+    /* stalemates */
+    { "k7/P7/1K6/8/8/8/8/8 b - - 0 1",    0 },
+    { "k7/8/K7/8/8/8/8/1R6 b - - 0 1",    0 },
+    { "k7/2Q5/1K6/8/8/8/8/8 b - - 0 1",   0 },
+    /* mates */
+    { "k7/8/1K6/8/8/8/8/R7 b - - 0 1",   -1 },
+    { "k7/1Q6/1K6/8/8/8/8/8 b - - 0 1",  -1 },
+    /* wins a long way from the mate */
+    { "8/8/8/8/8/4k3/8/R3K3 b - - 0 1",  -1 },
+    { "8/8/3k4/8/8/3K4/8/q7 b - - 0 1",   1 },
+};
+
+int main()
+{
+    init_tables();
+
+    size_t wrong = 0;
+    for (size_t i = 0; i < sizeof results / sizeof *results; i++) {
+        struct game_state g;
+        int               score;
+        if (!game_from_fen(&g, results[i].fen) || !bitbase_probe(&g, &score)) {
+            printf("%s isn't in a bitbase\n", results[i].fen);
+            wrong++;
+            continue;
+        }
+        const int result = (score > 0) - (score < 0);
+        if (result != results[i].result) {
+            printf("%s: %d instead of %d\n", results[i].fen, result, results[i].result);
+            wrong++;
+        }
+    }
+    printf("bitbases: %zu/%zu results right\n", sizeof results / sizeof *results - wrong, sizeof results / sizeof *results);
+    return wrong ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,42 @@
+#define main chess_main
+#include "../src/chess.c"
+#undef main
+
+/* The keys Polyglot's own documentation gives for a short game, which
+   between them cover castling rights being lost and an en passant file
+   that does and doesn't count. */
+static const struct {
+    const char* fen;
+    uint64_t    key;
+} book_keys[] = {
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",          0x463B96181691FC9CULL },
+    { "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1",       0x823C9B50FD114196ULL },
+    { "rnbqkbnr/ppp1pppp/8/3p4/4P3/8/PPPP1PPP/RNBQKBNR w KQkq d6 0 2",     0x0756B94461C50FB0ULL },
+    { "rnbqkbnr/ppp1pppp/8/3pP3/8/8/PPPP1PPP/RNBQKBNR b KQkq - 0 2",       0x662FAFB965DB29D4ULL },
+    { "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3",     0x22A48B5A8E47FF78ULL },
+    { "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR b kq - 0 3",        0x652A607CA3F242C1ULL },
+    { "rnbq1bnr/ppp1pkpp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR w - - 0 4",         0x00FDD303C946BDD9ULL },
+    { "rnbqkbnr/p1pppppp/8/8/PpP4P/8/1P1PPPP1/RNBQKBNR b KQkq c3 0 3",     0x3C8123EA7B067637ULL },
+    { "rnbqkbnr/p1pppppp/8/8/P6P/R1p5/1P1PPPP1/1NBQKBNR b Kkq - 0 4",      0x5C3F9B829B279560ULL },
+};
+
+int main()
+{
+    init_tables();
+
+    size_t wrong = 0;
+    for (size_t i = 0; i < sizeof book_keys / sizeof *book_keys; i++) {
+        struct game_state g;
+        if (!game_from_fen(&g, book_keys[i].fen)) {
+            printf("can't read %s\n", book_keys[i].fen);
+            return EXIT_FAILURE;
+        }
+        const uint64_t key = book_key(&g);
+        if (key != book_keys[i].key) {
+            printf("%s: key %016" PRIx64 " instead of %016" PRIx64 "\n", book_keys[i].fen, key, book_keys[i].key);
+            wrong++;
+        }
+    }
+    printf("book keys: %zu/%zu right\n", sizeof book_keys / sizeof *book_keys - wrong, sizeof book_keys / sizeof *book_keys);
+    return wrong ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,79 @@
+#define main chess_main
+#include "../src/chess.c"
+#undef main
+#include "positions.h"
+
+/* Every board evaluator the CPU can run has to agree with the scalar one,
+   on random boards as well as on real positions. */
+
+#define RANDOM_BOARDS 100000
+#define PERFT_DEPTH   3 /* every position this many plies from each perft position */
+
+static size_t check(const char* name, void (*scores)(const Board*, int32_t*, size_t),
+                    const Board* boards, const int32_t* expected, size_t n)
+{
+    int32_t* got = calloc(n, sizeof *got);
+    assert(got);
+    scores(boards, got, n);
+
+    size_t wrong = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (got[i] != expected[i] && wrong++ < 5)
+            printf("%s: board %zu scores %d instead of %d\n", name, i, got[i], expected[i]);
+    }
+    printf("%s: %zu/%zu boards agree\n", name, n - wrong, n);
+    free(got);
+    return wrong;
+}
+
+struct boards {
+    Board* boards;
+    size_t n;
+    size_t max;
+};
+
+static void add_board(struct game_state* g, void* arg)
+{
+    struct boards* b = arg;
+    assert(b->n < b->max);
+    memcpy(b->boards[b->n++], g->board, sizeof(Board));
+}
+
+int main()
+{
+    init_tables();
+
+    /* the perft counts say how many positions the walk will add */
+    const size_t max    = RANDOM_BOARDS + perft_positions_count(PERFT_DEPTH);
+    Board*       boards = calloc(max, sizeof *boards);
+    int32_t*     scores = calloc(max, sizeof *scores);
+    assert(boards && scores);
+
+    /* random boards, any piece of either color or nothing on every tile */
+    uint64_t seed = 0x2545F4914F6CDD1DULL;
+    size_t   n    = 0;
+    for (; n < RANDOM_BOARDS; n++) {
+        for (index_t i = 0; i < BOARD_SIZE; i++)
+            boards[n][i] = (piece_t)(random_u64(&seed) % (2*PAWN + 1)) - PAWN;
+    }
+
+    struct boards walked = { .boards = boards, .n = n, .max = max };
+    if (!walk_perft_positions(PERFT_DEPTH, add_board, &walked))
+        return EXIT_FAILURE;
+    n = walked.n;
+
+    board_scores_scalar((const Board*)boards, scores, n);
+
+    size_t wrong = check("dispatched", board_scores, (const Board*)boards, scores, n);
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1"))
+        wrong += check("sse4.1", board_scores_sse4, (const Board*)boards, scores, n);
+    if (__builtin_cpu_supports("avx2"))
+        wrong += check("avx2", board_scores_avx2, (const Board*)boards, scores, n);
+#endif
+
+    free(boards);
+    free(scores);
+    return wrong ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,64 @@
+#define main chess_main
+#include "../src/chess.c"
+#undef main
+
+/* Castling rights and en passant files that the board contradicts have to
+   be dropped when reading a FEN, or move() would castle with a rook that
+   isn't there or take a pawn en passant that never moved. Each position is
+   read, written back and counted with perft. */
+static const struct {
+    const char* fen;
+    const char* read; /* what game_to_fen() gives back */
+    int         depth;
+    uint64_t    nodes;
+} fens[] = {
+    /* the rights and files that do hold have to survive */
+    { "r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1",
+      "r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1",  2, 568 },
+    { "4k3/8/8/3Pp3/8/8/8/4K3 w - e6 0 1",
+      "4k3/8/8/3Pp3/8/8/8/4K3 w - e6 0 1",     1, 7 },
+    { "4k3/8/8/8/3pP3/8/8/4K3 b - e3 0 1",
+      "4k3/8/8/8/3pP3/8/8/4K3 b - e3 0 1",     1, 7 },
+    /* no rook on h1, no king on e8 */
+    { "4k3/8/8/8/8/8/8/4K3 w K - 0 1",
+      "4k3/8/8/8/8/8/8/4K3 w - - 0 1",         2, 25 },
+    { "r5kr/8/8/8/8/8/8/R3K3 b KQkq - 0 1",
+      "r5kr/8/8/8/8/8/8/R3K3 b Q - 0 1",       1, 23 },
+    /* no black pawn on e5, a pawn on the wrong rank, the wrong side to move */
+    { "4k3/8/8/3P4/8/8/8/4K3 w - e6 0 1",
+      "4k3/8/8/3P4/8/8/8/4K3 w - - 0 1",       2, 29 },
+    { "4k3/8/4p3/3P4/8/8/8/4K3 w - e6 0 1",
+      "4k3/8/4p3/3P4/8/8/8/4K3 w - - 0 1",     1, 7 },
+    { "4k3/8/8/3Pp3/8/8/8/4K3 b - e6 0 1",
+      "4k3/8/8/3Pp3/8/8/8/4K3 b - - 0 1",      1, 6 },
+};
+
+int main()
+{
+    init_tables();
+
+    size_t wrong = 0;
+    for (size_t i = 0; i < sizeof fens / sizeof *fens; i++) {
+        struct game_state g;
+        char              read[FEN_MAX];
+        if (!game_from_fen(&g, fens[i].fen)) {
+            printf("can't read %s\n", fens[i].fen);
+            wrong++;
+            continue;
+        }
+        bool right = true;
+        if (strcmp(game_to_fen(&g, read), fens[i].read) != 0) {
+            printf("%s: read as %s instead of %s\n", fens[i].fen, read, fens[i].read);
+            right = false;
+        }
+        const uint64_t nodes = perft(&g, fens[i].depth);
+        if (nodes != fens[i].nodes) {
+            printf("%s: perft %d gives %" PRIu64 " instead of %" PRIu64 "\n",
+                   fens[i].fen, fens[i].depth, nodes, fens[i].nodes);
+            right = false;
+        }
+        wrong += !right;
+    }
+    printf("fen: %zu/%zu positions right\n", sizeof fens / sizeof *fens - wrong, sizeof fens / sizeof *fens);
+    return wrong ? EXIT_FAILURE : EXIT_SUCCESS;
+}
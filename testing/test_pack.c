@@ -0,0 +1,45 @@
+#define main chess_main
+#include "../src/chess.c"
+#undef main
+#include "positions.h"
+
+/* Packing a position and unpacking it again has to give back the same
+   board, side to move, castling rights and en passant file, so the same
+   Zobrist key, and packing that once more the same 32 bytes. Checked on
+   every position up to three plies from each perft position. */
+
+#define DEPTH 3
+
+static size_t checked, wrong;
+
+static void check(struct game_state* g, void* arg)
+{
+    (void)arg;
+    struct board packed, repacked;
+    struct game_state unpacked;
+    game_pack(g, &packed);
+    game_unpack(&packed, &unpacked);
+    game_pack(&unpacked, &repacked);
+    checked++;
+
+    if (unpacked.hash == g->hash
+     && memcmp(unpacked.board, g->board, sizeof g->board) == 0
+     && board_equal(&packed, &repacked)
+     && board_hash(&packed) == board_hash(&repacked))
+        return;
+    if (wrong++ < 5) {
+        char fen[FEN_MAX];
+        printf("%s doesn't survive packing\n", game_to_fen(g, fen));
+    }
+}
+
+int main()
+{
+    init_tables();
+
+    if (!walk_perft_positions(DEPTH, check, NULL))
+        return EXIT_FAILURE;
+
+    printf("pack: %zu/%zu positions round-trip\n", checked - wrong, checked);
+    return wrong ? EXIT_FAILURE : EXIT_SUCCESS;
+}